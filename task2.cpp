@@ -7,109 +7,1643 @@
 #include <sstream>
 #include <stdexcept>
 #include <cstring>
+#include <deque>
+#include <functional>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <exception>
+#include <iomanip>
+#include <cstdlib>
+#include <cerrno>
+#include <string_view>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TASK2_POSIX 1
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TASK2_X86 1
+#endif
 using namespace std;
 
 const size_t CHUNK_SIZE = 1 << 20; // 1 MB
-mutex outputMutex;
+
+// Fixed-size work-stealing thread pool. Each worker owns a deque: it pops its
+// own jobs from the front (chunk order) and steals from the back of others
+// when it runs dry. Busy time is tracked per worker for the utilization report.
+class ThreadPool {
+    struct Worker {
+        deque<function<void()>> tasks;
+        mutex m;
+        atomic<uint64_t> busy_ns{0};
+        atomic<uint64_t> executed{0};
+        atomic<uint64_t> stolen{0};
+    };
+
+    vector<unique_ptr<Worker>> workers;
+    vector<thread> threads;
+    mutex wake_mutex;
+    condition_variable wake_cv;
+    condition_variable idle_cv;
+    atomic<size_t> queued{0};   // jobs sitting in a deque
+    atomic<size_t> pending{0};  // jobs submitted but not finished
+    atomic<size_t> next_worker{0};
+    bool stopping = false;
+    exception_ptr first_error;
+    chrono::steady_clock::time_point stats_start;
+
+    // Takes a job from our own deque, or steals one from another worker
+    bool pop_task(size_t self, function<void()>& task) {
+        {
+            Worker& own = *workers[self];
+            lock_guard<mutex> lock(own.m);
+            if (!own.tasks.empty()) {
+                task = move(own.tasks.front());
+                own.tasks.pop_front();
+                queued--;
+                return true;
+            }
+        }
+        for (size_t k = 1; k < workers.size(); ++k) {
+            Worker& victim = *workers[(self + k) % workers.size()];
+            lock_guard<mutex> lock(victim.m);
+            if (!victim.tasks.empty()) {
+                task = move(victim.tasks.back());
+                victim.tasks.pop_back();
+                queued--;
+                workers[self]->stolen++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Runs one job; busy time is charged to `worker` when it is a pool worker
+    void execute(function<void()>& task, Worker* worker) {
+        auto start = chrono::steady_clock::now();
+        try {
+            task();
+        } catch (...) {
+            lock_guard<mutex> lock(wake_mutex);
+            if (!first_error) first_error = current_exception();
+        }
+        if (worker) {
+            auto end = chrono::steady_clock::now();
+            worker->busy_ns += chrono::duration_cast<chrono::nanoseconds>(end - start).count();
+            worker->executed++;
+        }
+        if (--pending == 0) {
+            lock_guard<mutex> lock(wake_mutex);
+            idle_cv.notify_all();
+        }
+    }
+
+    void worker_loop(size_t self) {
+        Worker& me = *workers[self];
+        for (;;) {
+            function<void()> task;
+            if (pop_task(self, task)) {
+                execute(task, &me);
+                continue;
+            }
+            unique_lock<mutex> lock(wake_mutex);
+            wake_cv.wait(lock, [&] { return stopping || queued > 0; });
+            if (stopping && queued == 0) return;
+        }
+    }
+
+public:
+    explicit ThreadPool(size_t count) {
+        if (count == 0) count = 1;
+        for (size_t i = 0; i < count; ++i) workers.emplace_back(new Worker);
+        stats_start = chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i)
+            threads.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> lock(wake_mutex);
+            stopping = true;
+        }
+        wake_cv.notify_all();
+        for (thread& t : threads) t.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return workers.size(); }
+
+    // Queues a job on the next worker in round-robin order
+    void submit(function<void()> task) {
+        pending++;
+        Worker& w = *workers[next_worker++ % workers.size()];
+        {
+            lock_guard<mutex> lock(w.m);
+            w.tasks.push_back(move(task));
+        }
+        queued++;
+        {
+            lock_guard<mutex> lock(wake_mutex);
+        }
+        wake_cv.notify_one();
+    }
+
+    // Runs one queued job on the calling thread, if any. A job waiting on
+    // sub-jobs calls this instead of blocking, so nested waits cannot starve
+    // the pool. The time is already counted in the waiting job's own busy time.
+    bool run_one() {
+        function<void()> task;
+        if (!pop_task(next_worker++ % workers.size(), task)) return false;
+        execute(task, nullptr);
+        return true;
+    }
+
+    // Runs fn(0) .. fn(n - 1) on the pool and the calling thread and returns
+    // once all of them have finished; rethrows the first error
+    void parallel_for(size_t n, const function<void(size_t)>& fn) {
+        atomic<size_t> remaining{n};
+        mutex error_mutex;
+        exception_ptr error;
+        auto body = [&](size_t i) {
+            try {
+                fn(i);
+            } catch (...) {
+                lock_guard<mutex> lock(error_mutex);
+                if (!error) error = current_exception();
+            }
+            remaining--;
+        };
+        for (size_t i = 1; i < n; ++i) submit([&body, i] { body(i); });
+        if (n) body(0);
+        while (remaining > 0)
+            if (!run_one()) this_thread::yield();
+        if (error) rethrow_exception(error);
+    }
+
+    // Blocks until every submitted job has finished; rethrows the first job error
+    void wait_idle() {
+        unique_lock<mutex> lock(wake_mutex);
+        idle_cv.wait(lock, [&] { return pending == 0; });
+        if (first_error) {
+            exception_ptr err = first_error;
+            first_error = nullptr;
+            rethrow_exception(err);
+        }
+    }
+
+    void reset_stats() {
+        for (auto& w : workers) {
+            w->busy_ns = 0;
+            w->executed = 0;
+            w->stolen = 0;
+        }
+        stats_start = chrono::steady_clock::now();
+    }
+
+    // Prints busy time as a share of wall time for each worker since the last reset.
+    // Low utilization with a fast codec means the run was I/O-bound.
+    void report(ostream& os) const {
+        double wall_ns = chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now() - stats_start).count();
+        double total = 0;
+        ios_base::fmtflags flags = os.flags();
+        streamsize precision = os.precision();
+        os << "Worker utilization (" << workers.size() << " threads):\n";
+        for (size_t i = 0; i < workers.size(); ++i) {
+            double util = wall_ns > 0 ? 100.0 * workers[i]->busy_ns / wall_ns : 0;
+            total += util;
+            os << "  worker " << i << ": " << fixed << setprecision(1) << util << "% busy, "
+               << workers[i]->executed << " jobs, " << workers[i]->stolen << " stolen\n";
+        }
+        os << "  average: " << total / workers.size() << "% busy\n";
+        os.flags(flags);
+        os.precision(precision);
+    }
+};
+
+// Picks the worker count: hardware_concurrency() unless overridden
+size_t default_thread_count() {
+    size_t n = thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+// Largest output rle_compress can produce for n input bytes
+size_t rle_max_size(size_t n) { return 2 * n; }
+
+// Run-Length Encoding of n bytes into dst (at least rle_max_size(n) bytes).
+// Emits (byte, count) pairs with count capped at 255; returns bytes written.
+size_t rle_compress_scalar(const char* src, size_t n, char* dst) {
+    char* out = dst;
+    for (size_t i = 0; i < n; ) {
+        char current = src[i];
+        size_t limit = min<size_t>(255, n - i);
+        size_t count = 1;
+        while (count < limit && src[i + count] == current) count++;
+        *out++ = current;
+        *out++ = (char)count;
+        i += count;
+    }
+    return out - dst;
+}
+
+#ifdef TASK2_X86
+// SSE2 run scanner: compares 16 bytes per step against the run byte
+size_t rle_compress_sse2(const char* src, size_t n, char* dst) {
+    char* out = dst;
+    for (size_t i = 0; i < n; ) {
+        const char* p = src + i;
+        size_t limit = min<size_t>(255, n - i);
+        size_t count = 1;
+        if (count < limit && p[1] == p[0]) {
+            __m128i needle = _mm_set1_epi8(p[0]);
+            while (count + 16 <= limit) {
+                __m128i v = _mm_loadu_si128((const __m128i*)(p + count));
+                unsigned diff = ~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)) & 0xFFFF;
+                if (diff) { count += __builtin_ctz(diff); goto emit; }
+                count += 16;
+            }
+            while (count < limit && p[count] == p[0]) count++;
+        }
+    emit:
+        *out++ = p[0];
+        *out++ = (char)count;
+        i += count;
+    }
+    return out - dst;
+}
+
+// AVX2 run scanner: compares 32 bytes per step against the run byte
+__attribute__((target("avx2")))
+size_t rle_compress_avx2(const char* src, size_t n, char* dst) {
+    char* out = dst;
+    for (size_t i = 0; i < n; ) {
+        const char* p = src + i;
+        size_t limit = min<size_t>(255, n - i);
+        size_t count = 1;
+        if (count < limit && p[1] == p[0]) {
+            __m256i needle = _mm256_set1_epi8(p[0]);
+            while (count + 32 <= limit) {
+                __m256i v = _mm256_loadu_si256((const __m256i*)(p + count));
+                unsigned diff = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+                if (diff) { count += __builtin_ctz(diff); goto emit; }
+                count += 32;
+            }
+            while (count < limit && p[count] == p[0]) count++;
+        }
+    emit:
+        *out++ = p[0];
+        *out++ = (char)count;
+        i += count;
+    }
+    return out - dst;
+}
+#endif
+
+using RleEncodeFn = size_t (*)(const char*, size_t, char*);
+
+// Picks the widest run scanner the CPU supports, once at startup
+RleEncodeFn select_rle_encoder(const char** name) {
+#ifdef TASK2_X86
+    if (__builtin_cpu_supports("avx2")) { *name = "avx2"; return rle_compress_avx2; }
+    if (__builtin_cpu_supports("sse2")) { *name = "sse2"; return rle_compress_sse2; }
+#endif
+    *name = "scalar";
+    return rle_compress_scalar;
+}
+
+const char* rle_encoder_name = "scalar";
+const RleEncodeFn rle_compress_into = select_rle_encoder(&rle_encoder_name);
 
 // Run-Length Encoding compression for a chunk
 string rle_compress(const string& data) {
-    stringstream ss;
-    int n = data.size();
-    for (int i = 0; i < n; ) {
-        char current = data[i];
-        int count = 1;
-        while (i + count < n && data[i + count] == current && count < 255)
-            count++;
-        ss << current << (char)count;
-        i += count;
+    string out(rle_max_size(data.size()), '\0');
+    out.resize(rle_compress_into(data.data(), data.size(), &out[0]));
+    return out;
+}
+
+// Outcome of an RLE decode; decoding never throws part-way through a buffer
+enum class DecodeStatus { OK, TRUNCATED, ZERO_RUN, OUTPUT_TOO_SMALL, BAD_MATCH };
+
+const char* decode_status_message(DecodeStatus status) {
+    switch (status) {
+    case DecodeStatus::OK: return "ok";
+    case DecodeStatus::TRUNCATED: return "Corrupted compressed data: truncated run pair.";
+    case DecodeStatus::ZERO_RUN: return "Corrupted compressed data: zero-length run.";
+    case DecodeStatus::OUTPUT_TOO_SMALL: return "Corrupted compressed data: output size mismatch.";
+    case DecodeStatus::BAD_MATCH: return "Corrupted compressed data: match offset out of range.";
     }
-    return ss.str();
+    return "Corrupted compressed data.";
+}
+
+// Validation pass: checks the pair stream and computes the exact decoded size
+DecodeStatus rle_decoded_size(const char* src, size_t n, size_t& size) {
+    size = 0;
+    if (n % 2 != 0) return DecodeStatus::TRUNCATED;
+    for (size_t i = 1; i < n; i += 2) {
+        unsigned char count = src[i];
+        if (count == 0) return DecodeStatus::ZERO_RUN;
+        size += count;
+    }
+    return DecodeStatus::OK;
+}
+
+// Decodes a validated pair stream into a caller-owned buffer of `capacity`
+// bytes with one memset per run; nothing is allocated
+DecodeStatus rle_decompress_into(const char* src, size_t n, char* dst, size_t capacity,
+                                 size_t& written) {
+    written = 0;
+    if (n % 2 != 0) return DecodeStatus::TRUNCATED;
+    for (size_t i = 0; i < n; i += 2) {
+        size_t count = (unsigned char)src[i + 1];
+        if (count > capacity - written) return DecodeStatus::OUTPUT_TOO_SMALL;
+        memset(dst + written, src[i], count);
+        written += count;
+    }
+    return DecodeStatus::OK;
 }
 
 // Decompression of an RLE-compressed chunk
 string rle_decompress(const string& data) {
-    stringstream ss;
-    int n = data.size();
-    for (int i = 0; i < n; i += 2) {
-        if (i + 1 >= n) throw runtime_error("Corrupted compressed data.");
-        char ch = data[i];
-        int count = (unsigned char)data[i + 1];
-        ss << string(count, ch);
+    size_t size, written;
+    DecodeStatus status = rle_decoded_size(data.data(), data.size(), size);
+    string out(size, '\0');
+    if (status == DecodeStatus::OK)
+        status = rle_decompress_into(data.data(), data.size(), &out[0], size, written);
+    if (status != DecodeStatus::OK) throw runtime_error(decode_status_message(status));
+    return out;
+}
+
+// PackBits-style literal/run encoding. A control byte c < 128 is followed by
+// c + 1 literal bytes; c >= 128 is followed by one byte repeated c - 125 times
+// (runs of 3..130). Unlike plain RLE, incompressible data grows by at most one
+// byte in 128.
+const size_t PACKBITS_MAX_LITERAL = 128;
+const size_t PACKBITS_MIN_RUN = 3;
+const size_t PACKBITS_MAX_RUN = 130;
+
+size_t packbits_max_size(size_t n) { return n + (n + PACKBITS_MAX_LITERAL - 1) / PACKBITS_MAX_LITERAL; }
+
+size_t packbits_compress_into(const char* src, size_t n, char* dst) {
+    char* out = dst;
+    size_t literal_start = 0;
+    auto flush_literals = [&](size_t end) {
+        while (literal_start < end) {
+            size_t len = min(PACKBITS_MAX_LITERAL, end - literal_start);
+            *out++ = (char)(len - 1);
+            memcpy(out, src + literal_start, len);
+            out += len;
+            literal_start += len;
+        }
+    };
+    for (size_t i = 0; i < n; ) {
+        size_t limit = min(PACKBITS_MAX_RUN, n - i);
+        size_t run = 1;
+        while (run < limit && src[i + run] == src[i]) run++;
+        if (run >= PACKBITS_MIN_RUN) {
+            flush_literals(i);
+            *out++ = (char)(128 + run - PACKBITS_MIN_RUN);
+            *out++ = src[i];
+            literal_start = i + run;
+        }
+        i += run;
     }
-    return ss.str();
+    flush_literals(n);
+    return out - dst;
 }
 
-// Compress a chunk in a thread and store it in the result vector
-void compress_chunk(const string& chunk, vector<string>& results, int index) {
-    string compressed = rle_compress(chunk);
-    lock_guard<mutex> lock(outputMutex);
-    results[index] = compressed;
+// Validation pass for a PackBits stream: computes the exact decoded size
+DecodeStatus packbits_decoded_size(const char* src, size_t n, size_t& size) {
+    size = 0;
+    for (size_t i = 0; i < n; ) {
+        unsigned char c = src[i++];
+        if (c < 128) {
+            if (n - i < (size_t)c + 1) return DecodeStatus::TRUNCATED;
+            size += c + 1;
+            i += c + 1;
+        } else {
+            if (i >= n) return DecodeStatus::TRUNCATED;
+            size += c - 128 + PACKBITS_MIN_RUN;
+            i++;
+        }
+    }
+    return DecodeStatus::OK;
 }
 
-// Decompress a chunk in a thread
-void decompress_chunk(const string& chunk, vector<string>& results, int index) {
-    string decompressed = rle_decompress(chunk);
-    lock_guard<mutex> lock(outputMutex);
-    results[index] = decompressed;
+// Decodes a validated PackBits stream into a caller-owned buffer
+DecodeStatus packbits_decompress_into(const char* src, size_t n, char* dst, size_t capacity,
+                                      size_t& written) {
+    written = 0;
+    for (size_t i = 0; i < n; ) {
+        unsigned char c = src[i++];
+        size_t len = c < 128 ? (size_t)c + 1 : (size_t)c - 128 + PACKBITS_MIN_RUN;
+        if (len > capacity - written) return DecodeStatus::OUTPUT_TOO_SMALL;
+        if (c < 128) {
+            if (n - i < len) return DecodeStatus::TRUNCATED;
+            memcpy(dst + written, src + i, len);
+            i += len;
+        } else {
+            if (i >= n) return DecodeStatus::TRUNCATED;
+            memset(dst + written, src[i++], len);
+        }
+        written += len;
+    }
+    return DecodeStatus::OK;
 }
 
-// Read file into chunks
-vector<string> read_file_chunks(const string& filepath) {
-    ifstream in(filepath, ios::binary);
-    if (!in) throw runtime_error("Error opening input file.");
-    vector<string> chunks;
-    while (!in.eof()) {
-        string chunk(CHUNK_SIZE, '\0');
-        in.read(&chunk[0], CHUNK_SIZE);
-        chunk.resize(in.gcount());
-        if (!chunk.empty()) chunks.push_back(chunk);
+// LZ77 dictionary codec in the style of an LZ4 block. Each sequence is a token
+// byte (high nibble: literal count, low nibble: match length - 4, 15 meaning
+// "more length bytes follow", each adding up to 255), the literals, a u16
+// match offset and any extra match length bytes. The final sequence carries
+// literals only. Matches are found through a hash table of 4-byte prefixes.
+const size_t LZ_MIN_MATCH = 4;
+const size_t LZ_MAX_OFFSET = 65535;
+const int LZ_HASH_BITS = 16;
+const int LZ_MIN_LEVEL = 1;
+const int LZ_MAX_LEVEL = 9;
+
+size_t lz77_max_size(size_t n) { return n + n / 255 + 16; }
+
+uint32_t load_u32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+// Writes a length that did not fit in its token nibble
+char* lz77_put_length(char* out, size_t len) {
+    for (; len >= 255; len -= 255) *out++ = (char)255;
+    *out++ = (char)len;
+    return out;
+}
+
+char* lz77_put_sequence(char* out, const char* literals, size_t literal_len,
+                        size_t offset, size_t match_len) {
+    size_t match_code = match_len ? match_len - LZ_MIN_MATCH : 0;
+    char* token = out++;
+    *token = (char)((min<size_t>(literal_len, 15) << 4) | min<size_t>(match_code, 15));
+    if (literal_len >= 15) out = lz77_put_length(out, literal_len - 15);
+    memcpy(out, literals, literal_len);
+    out += literal_len;
+    if (match_len) {
+        *out++ = (char)offset;
+        *out++ = (char)(offset >> 8);
+        if (match_code >= 15) out = lz77_put_length(out, match_code - 15);
     }
-    return chunks;
+    return out;
 }
 
-// Write string chunks to output file
-void write_chunks_to_file(const string& filepath, const vector<string>& chunks) {
-    ofstream out(filepath, ios::binary);
-    if (!out) throw runtime_error("Error opening output file.");
-    for (const string& chunk : chunks)
-        out.write(chunk.data(), chunk.size());
+uint32_t lz77_hash(uint32_t seq, int bits) { return (seq * 2654435761u) >> (32 - bits); }
+
+// Level 1 checks a single hash candidate and skips ahead through data that
+// keeps failing to match. Higher levels follow hash chains up to
+// 2^(level - 1) candidates deep and keep the longest match.
+size_t lz77_compress_into(const char* src, size_t n, char* dst, int level) {
+    // Positions are stored +1 so that 0 means "empty"; the tables are per
+    // thread to keep them off the per-chunk allocation path
+    thread_local vector<uint32_t> head;
+    thread_local vector<uint32_t> chain;
+    // Small inputs (archived small files) get a table sized to them, so
+    // clearing it does not dominate the cost of the chunk
+    int bits = 10;
+    while (bits < LZ_HASH_BITS && ((size_t)1 << bits) < n) bits++;
+    head.assign((size_t)1 << bits, 0);
+    size_t depth = (size_t)1 << (clamp(level, LZ_MIN_LEVEL, LZ_MAX_LEVEL) - 1);
+    bool use_chain = depth > 1;
+    if (use_chain && chain.size() < n) chain.resize(n);
+
+    char* out = dst;
+    size_t anchor = 0;
+    size_t i = 0;
+    while (n >= LZ_MIN_MATCH && i <= n - LZ_MIN_MATCH) {
+        uint32_t seq = load_u32(src + i);
+        uint32_t h = lz77_hash(seq, bits);
+        size_t candidate = head[h];
+        head[h] = i + 1;
+        if (use_chain) chain[i] = candidate;
+
+        size_t best_len = 0, best_pos = 0;
+        for (size_t d = 0; candidate && d < depth; ++d) {
+            size_t pos = candidate - 1;
+            if (i - pos > LZ_MAX_OFFSET) break;
+            if (load_u32(src + pos) == seq) {
+                size_t len = LZ_MIN_MATCH;
+                while (i + len < n && src[pos + len] == src[i + len]) len++;
+                if (len > best_len) {
+                    best_len = len;
+                    best_pos = pos;
+                }
+            }
+            if (!use_chain) break;
+            candidate = chain[pos];
+        }
+
+        if (best_len) {
+            out = lz77_put_sequence(out, src + anchor, i - anchor, i - best_pos, best_len);
+            if (use_chain) {
+                // Index the positions inside the match so later data can refer to them
+                size_t stop = min(i + best_len, n - LZ_MIN_MATCH + 1);
+                for (size_t k = i + 1; k < stop; ++k) {
+                    uint32_t hk = lz77_hash(load_u32(src + k), bits);
+                    chain[k] = head[hk];
+                    head[hk] = k + 1;
+                }
+            }
+            i += best_len;
+            anchor = i;
+        } else {
+            i += use_chain ? 1 : 1 + ((i - anchor) >> 6);
+        }
+    }
+    return lz77_put_sequence(out, src + anchor, n - anchor, 0, 0) - dst;
 }
 
-// Compress using multithreading
-void compress(const string& input_path, const string& output_path) {
-    auto chunks = read_file_chunks(input_path);
-    vector<string> results(chunks.size());
-    vector<thread> threads;
+// Reads an extended length; false if the stream ends first
+bool lz77_get_length(const char* src, size_t n, size_t& i, size_t& len) {
+    unsigned char b;
+    do {
+        if (i >= n) return false;
+        b = src[i++];
+        len += b;
+    } while (b == 255);
+    return true;
+}
 
-    auto start = chrono::high_resolution_clock::now();
-    for (size_t i = 0; i < chunks.size(); ++i)
-        threads.emplace_back(compress_chunk, cref(chunks[i]), ref(results), i);
-    for (thread& t : threads) t.join();
-    auto end = chrono::high_resolution_clock::now();
+// Decodes exactly raw_size bytes into dst; every offset and length is checked
+DecodeStatus lz77_decompress_into(const char* src, size_t n, char* dst, size_t raw_size) {
+    size_t i = 0, written = 0;
+    while (i < n) {
+        unsigned char token = src[i++];
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && !lz77_get_length(src, n, i, literal_len))
+            return DecodeStatus::TRUNCATED;
+        if (literal_len > n - i) return DecodeStatus::TRUNCATED;
+        if (literal_len > raw_size - written) return DecodeStatus::OUTPUT_TOO_SMALL;
+        memcpy(dst + written, src + i, literal_len);
+        i += literal_len;
+        written += literal_len;
+        if (i == n) break;
 
-    write_chunks_to_file(output_path, results);
+        if (n - i < 2) return DecodeStatus::TRUNCATED;
+        size_t offset = (unsigned char)src[i] | (size_t)(unsigned char)src[i + 1] << 8;
+        i += 2;
+        size_t match_len = token & 15;
+        if (match_len == 15 && !lz77_get_length(src, n, i, match_len))
+            return DecodeStatus::TRUNCATED;
+        match_len += LZ_MIN_MATCH;
+        if (offset == 0 || offset > written) return DecodeStatus::BAD_MATCH;
+        if (match_len > raw_size - written) return DecodeStatus::OUTPUT_TOO_SMALL;
+        char* out = dst + written;
+        const char* from = out - offset;
+        if (offset >= match_len) memcpy(out, from, match_len);
+        else for (size_t k = 0; k < match_len; ++k) out[k] = from[k];
+        written += match_len;
+    }
+    return written == raw_size ? DecodeStatus::OK : DecodeStatus::OUTPUT_TOO_SMALL;
+}
 
-    chrono::duration<double> duration = end - start;
-    cout << "Multi-threaded compression completed in " << duration.count() << " seconds.\n";
+// Identifies a chunk's payload encoding; stored in each frame
+enum class CodecId : uint8_t { RAW = 0, RLE = 1, PACKBITS = 2, LZ77 = 3 };
+const size_t CODEC_COUNT = 4;
+
+// A chunk codec. compress() writes at most max_bound(n) bytes, trading speed
+// for ratio by `level` where the codec supports it; decompress() must produce
+// exactly raw_size bytes or report why it could not.
+class Codec {
+public:
+    virtual ~Codec() = default;
+    virtual CodecId id() const = 0;
+    virtual const char* name() const = 0;
+    virtual size_t max_bound(size_t n) const = 0;
+    virtual size_t compress(const char* src, size_t n, char* dst, int level) const = 0;
+    virtual DecodeStatus decompress(const char* src, size_t n, char* dst, size_t raw_size) const = 0;
+};
+
+class RawCodec : public Codec {
+public:
+    CodecId id() const override { return CodecId::RAW; }
+    const char* name() const override { return "raw"; }
+    size_t max_bound(size_t n) const override { return n; }
+    size_t compress(const char* src, size_t n, char* dst, int) const override {
+        memcpy(dst, src, n);
+        return n;
+    }
+    DecodeStatus decompress(const char* src, size_t n, char* dst, size_t raw_size) const override {
+        if (n != raw_size) return DecodeStatus::OUTPUT_TOO_SMALL;
+        memcpy(dst, src, n);
+        return DecodeStatus::OK;
+    }
+};
+
+class RleCodec : public Codec {
+public:
+    CodecId id() const override { return CodecId::RLE; }
+    const char* name() const override { return "rle"; }
+    size_t max_bound(size_t n) const override { return rle_max_size(n); }
+    size_t compress(const char* src, size_t n, char* dst, int) const override {
+        return rle_compress_into(src, n, dst);
+    }
+    DecodeStatus decompress(const char* src, size_t n, char* dst, size_t raw_size) const override {
+        size_t size, written;
+        DecodeStatus status = rle_decoded_size(src, n, size);
+        if (status != DecodeStatus::OK) return status;
+        if (size != raw_size) return DecodeStatus::OUTPUT_TOO_SMALL;
+        return rle_decompress_into(src, n, dst, raw_size, written);
+    }
+};
+
+class PackBitsCodec : public Codec {
+public:
+    CodecId id() const override { return CodecId::PACKBITS; }
+    const char* name() const override { return "packbits"; }
+    size_t max_bound(size_t n) const override { return packbits_max_size(n); }
+    size_t compress(const char* src, size_t n, char* dst, int) const override {
+        return packbits_compress_into(src, n, dst);
+    }
+    DecodeStatus decompress(const char* src, size_t n, char* dst, size_t raw_size) const override {
+        size_t size, written;
+        DecodeStatus status = packbits_decoded_size(src, n, size);
+        if (status != DecodeStatus::OK) return status;
+        if (size != raw_size) return DecodeStatus::OUTPUT_TOO_SMALL;
+        return packbits_decompress_into(src, n, dst, raw_size, written);
+    }
+};
+
+class Lz77Codec : public Codec {
+public:
+    CodecId id() const override { return CodecId::LZ77; }
+    const char* name() const override { return "lz77"; }
+    size_t max_bound(size_t n) const override { return lz77_max_size(n); }
+    size_t compress(const char* src, size_t n, char* dst, int level) const override {
+        return lz77_compress_into(src, n, dst, level);
+    }
+    DecodeStatus decompress(const char* src, size_t n, char* dst, size_t raw_size) const override {
+        return lz77_decompress_into(src, n, dst, raw_size);
+    }
+};
+
+// Codec registry, indexed by CodecId
+const Codec* codec_for(CodecId id) {
+    static const RawCodec raw;
+    static const RleCodec rle;
+    static const PackBitsCodec packbits;
+    static const Lz77Codec lz77;
+    static const Codec* const codecs[CODEC_COUNT] = {&raw, &rle, &packbits, &lz77};
+    return (size_t)id < CODEC_COUNT ? codecs[(size_t)id] : nullptr;
 }
 
-// Decompress using multithreading
-void decompress(const string& input_path, const string& output_path) {
-    auto chunks = read_file_chunks(input_path);
-    vector<string> results(chunks.size());
-    vector<thread> threads;
+const Codec* codec_by_name(const string& name) {
+    for (size_t i = 0; i < CODEC_COUNT; ++i)
+        if (name == codec_for((CodecId)i)->name()) return codec_for((CodecId)i);
+    throw invalid_argument("Unknown codec: " + name);
+}
+
+// Smallest piece a chunk is split into for parallel RLE
+const size_t MIN_SPLIT_SIZE = 16 << 10;
+
+// RLE-encodes one chunk as `parts` pieces on the pool, then joins them. A run
+// that crosses a split boundary comes out of the two pieces as separate pairs,
+// so the join re-encodes it: it pops the trailing pairs of that byte from the
+// output and the leading pairs from the next piece, adds their counts, and
+// writes them back as 255-capped pairs. The result is byte-identical to
+// rle_compress_into() on the whole chunk.
+size_t rle_compress_parallel(const char* src, size_t n, char* dst, ThreadPool& pool, size_t parts) {
+    parts = max<size_t>(1, min(parts, n / MIN_SPLIT_SIZE));
+    if (parts == 1) return rle_compress_into(src, n, dst);
+
+    size_t piece = (n + parts - 1) / parts;
+    vector<string> encoded(parts);
+    pool.parallel_for(parts, [&](size_t p) {
+        size_t begin = min(n, p * piece), len = min(n, begin + piece) - begin;
+        encoded[p].resize(rle_max_size(len));
+        encoded[p].resize(rle_compress_into(src + begin, len, &encoded[p][0]));
+    });
+
+    char* out = dst;
+    for (const string& e : encoded) {
+        size_t skip = 0;
+        if (out > dst && !e.empty() && out[-2] == e[0]) {
+            char c = e[0];
+            size_t total = 0;
+            while (out > dst && out[-2] == c) {
+                total += (unsigned char)out[-1];
+                out -= 2;
+            }
+            while (skip < e.size() && e[skip] == c) {
+                total += (unsigned char)e[skip + 1];
+                skip += 2;
+            }
+            for (; total > 0; total -= min<size_t>(total, 255)) {
+                *out++ = c;
+                *out++ = (char)min<size_t>(total, 255);
+            }
+        }
+        memcpy(out, e.data() + skip, e.size() - skip);
+        out += e.size() - skip;
+    }
+    return out - dst;
+}
+
+// Container layout (all integers little-endian):
+//   header : magic "TK2C", u16 version, u16 flags, u32 chunk size, u32 reserved
+//   frame  : u32 compressed length, u32 raw length, u32 checksum,
+//            u8 codec id, 3 reserved bytes, payload
+//            (the checksum is the CRC32C of the raw chunk)
+//   index  : magic "TK2I", u32 chunk count, u32 CRC32C of the entries,
+//            u32 size of the extra section, then per chunk
+//            u64 frame offset, u32 compressed length, u32 raw length,
+//            then the extra section (the file table of an archive)
+//   footer : u64 index offset, u32 chunk count, magic "TK2E"
+// Frames can be decoded independently; the index lets a reader seek straight
+// to the chunks covering a byte range of the original file. No chunk is
+// larger than the header's chunk size, and no payload is larger than its
+// chunk (incompressible chunks are stored raw), so readers reject any length
+// above the chunk size before allocating for it.
+const char CONTAINER_MAGIC[4] = {'T', 'K', '2', 'C'};
+const char INDEX_MAGIC[4] = {'T', 'K', '2', 'I'};
+const char FOOTER_MAGIC[4] = {'T', 'K', '2', 'E'};
+const uint16_t CONTAINER_VERSION = 3;
+const uint16_t FLAG_ARCHIVE = 1;  // header flag: many files plus a file table
+const size_t HEADER_SIZE = 16;
+const size_t FRAME_HEADER_SIZE = 16;
+
+// Per-codec totals for the compression report
+struct CodecStats {
+    atomic<uint64_t> chunks{0};
+    atomic<uint64_t> raw_bytes{0};
+    atomic<uint64_t> stored_bytes{0};
+    atomic<uint64_t> ns{0};
+};
+CodecStats codec_stats[CODEC_COUNT];
+
+void reset_codec_stats() {
+    for (CodecStats& m : codec_stats) {
+        m.chunks = 0;
+        m.raw_bytes = 0;
+        m.stored_bytes = 0;
+        m.ns = 0;
+    }
+}
+
+void record_codec_stats(CodecId id, size_t raw, size_t stored,
+                        chrono::steady_clock::time_point start) {
+    CodecStats& m = codec_stats[(size_t)id];
+    m.chunks++;
+    m.raw_bytes += raw;
+    m.stored_bytes += stored;
+    m.ns += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
+// Prints ratio and per-thread throughput for every codec that was used
+void report_codec_stats(ostream& os) {
+    for (size_t i = 0; i < CODEC_COUNT; ++i) {
+        const CodecStats& m = codec_stats[i];
+        if (m.chunks == 0) continue;
+        os << "  codec " << codec_for((CodecId)i)->name() << ": " << m.chunks << " chunks, ratio "
+           << (double)m.stored_bytes / max<uint64_t>(m.raw_bytes, 1) << ", "
+           << m.raw_bytes / 1e6 / max(m.ns / 1e9, 1e-9) << " MB/s per thread\n";
+    }
+}
+const size_t INDEX_HEADER_SIZE = 16;
+const size_t INDEX_ENTRY_SIZE = 16;
+const size_t FOOTER_SIZE = 16;
+
+struct IndexEntry {
+    uint64_t offset;
+    uint32_t compressed_size;
+    uint32_t raw_size;
+};
+
+void put_u16(char* p, uint16_t v) {
+    for (int i = 0; i < 2; ++i) p[i] = (char)(v >> (8 * i));
+}
+
+void put_u32(char* p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = (char)(v >> (8 * i));
+}
+
+void put_u64(char* p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) p[i] = (char)(v >> (8 * i));
+}
+
+uint16_t get_u16(const char* p) {
+    return (uint16_t)((unsigned char)p[0] | (unsigned char)p[1] << 8);
+}
+
+uint32_t get_u32(const char* p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= (uint32_t)(unsigned char)p[i] << (8 * i);
+    return v;
+}
+
+uint64_t get_u64(const char* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v |= (uint64_t)(unsigned char)p[i] << (8 * i);
+    return v;
+}
+
+// CRC32C (Castagnoli) of the raw chunk, stored in each frame and checked as
+// each chunk is decoded. Slicing-by-8 tables for the software path.
+struct Crc32cTables {
+    uint32_t t[8][256];
+    Crc32cTables() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c >> 1) ^ (0x82F63B78u & (0u - (c & 1)));
+            t[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; ++i)
+            for (int k = 1; k < 8; ++k) t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+    }
+};
+
+uint32_t crc32c_software(const char* data, size_t n) {
+    static const Crc32cTables tables;
+    const uint32_t (*t)[256] = tables.t;
+    const unsigned char* p = (const unsigned char*)data;
+    uint32_t crc = ~0u;
+    for (; n >= 8; n -= 8, p += 8) {
+        uint32_t lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+              t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+    }
+    while (n--) crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+// SSE4.2 CRC32 instruction, eight bytes per step
+__attribute__((target("sse4.2")))
+uint32_t crc32c_sse42(const char* data, size_t n) {
+    uint64_t crc = ~0u;
+    for (; n >= 8; n -= 8, data += 8) {
+        uint64_t v;
+        memcpy(&v, data, 8);
+        crc = _mm_crc32_u64(crc, v);
+    }
+    uint32_t crc32 = (uint32_t)crc;
+    while (n--) crc32 = _mm_crc32_u8(crc32, (unsigned char)*data++);
+    return ~crc32;
+}
+#endif
+
+using Crc32cFn = uint32_t (*)(const char*, size_t);
+
+Crc32cFn select_crc32c(const char** name) {
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2")) { *name = "sse4.2"; return crc32c_sse42; }
+#endif
+    *name = "software";
+    return crc32c_software;
+}
+
+const char* crc32c_name = "software";
+const Crc32cFn chunk_checksum = select_crc32c(&crc32c_name);
+
+// Compress a chunk into a self-contained frame. The chunk is stored raw
+// whenever the preferred codec would not make it smaller.
+// With a `split_pool`, RLE chunks are encoded as `split_parts` parallel pieces.
+void compress_chunk(string_view chunk, string& frame, const Codec& preferred, int level,
+                    ThreadPool* split_pool = nullptr, size_t split_parts = 1) {
+    auto start = chrono::steady_clock::now();
+    size_t n = chunk.size();
+    const Codec* codec = &preferred;
+    frame.resize(FRAME_HEADER_SIZE + max(codec->max_bound(n), n));
+    char* payload = &frame[FRAME_HEADER_SIZE];
+
+    size_t size = split_pool && split_parts > 1 && codec->id() == CodecId::RLE
+        ? rle_compress_parallel(chunk.data(), n, payload, *split_pool, split_parts)
+        : codec->compress(chunk.data(), n, payload, level);
+    if (size >= n && codec->id() != CodecId::RAW) {
+        codec = codec_for(CodecId::RAW);
+        size = codec->compress(chunk.data(), n, payload, level);
+    }
+
+    frame.resize(FRAME_HEADER_SIZE + size);
+    put_u32(&frame[0], size);
+    put_u32(&frame[4], n);
+    put_u32(&frame[8], chunk_checksum(chunk.data(), n));
+    put_u32(&frame[12], (uint32_t)codec->id());
+    record_codec_stats(codec->id(), n, size, start);
+}
+
+// Decompress one frame into `result` and verify its stored length and checksum.
+// `result` is a pipeline slot buffer, so after the first pass over the ring it
+// already has the capacity for a whole chunk and decoding does not allocate.
+// `chunk_size` comes from the container header and bounds the raw length.
+void decompress_chunk(string_view frame, string& result, size_t chunk_size) {
+    auto start = chrono::steady_clock::now();
+    if (frame.size() < FRAME_HEADER_SIZE ||
+        frame.size() - FRAME_HEADER_SIZE != get_u32(&frame[0]))
+        throw runtime_error("Corrupted compressed data.");
+    const Codec* codec = codec_for((CodecId)frame[12]);
+    if (!codec) throw runtime_error("Corrupted compressed data: unknown codec.");
+    const char* payload = frame.data() + FRAME_HEADER_SIZE;
+    size_t payload_size = frame.size() - FRAME_HEADER_SIZE;
+    size_t raw_size = get_u32(&frame[4]);
+    if (raw_size > chunk_size) throw runtime_error("Corrupted compressed data: chunk too large.");
+
+    result.resize(raw_size);
+    DecodeStatus status = codec->decompress(payload, payload_size, &result[0], raw_size);
+    if (status != DecodeStatus::OK) throw runtime_error(decode_status_message(status));
+    if (chunk_checksum(result.data(), result.size()) != get_u32(&frame[8]))
+        throw runtime_error("Corrupted compressed data: checksum mismatch.");
+    record_codec_stats(codec->id(), raw_size, payload_size, start);
+}
+
+// Fills `chunk` with up to `chunk_size` bytes from the stream, reusing its buffer
+bool read_next_chunk(istream& in, string& chunk, size_t chunk_size) {
+    chunk.resize(chunk_size);
+    in.read(&chunk[0], chunk_size);
+    chunk.resize(in.gcount());
+    return !chunk.empty();
+}
+
+// Reads the next whole frame (header and payload) from a container stream.
+// Returns false once the index table is reached.
+bool read_next_frame(istream& in, string& frame, size_t chunk_size) {
+    frame.resize(FRAME_HEADER_SIZE);
+    in.read(&frame[0], FRAME_HEADER_SIZE);
+    if (in.gcount() >= 4 && memcmp(&frame[0], INDEX_MAGIC, 4) == 0) return false;
+    if (in.gcount() != (streamsize)FRAME_HEADER_SIZE)
+        throw runtime_error("Corrupted compressed data: truncated frame.");
+    size_t payload = get_u32(&frame[0]);
+    if (payload > chunk_size) throw runtime_error("Corrupted compressed data: chunk too large.");
+    frame.resize(FRAME_HEADER_SIZE + payload);
+    in.read(&frame[FRAME_HEADER_SIZE], payload);
+    if ((size_t)in.gcount() != payload)
+        throw runtime_error("Corrupted compressed data: truncated frame.");
+    return true;
+}
+
+string container_header(size_t chunk_size, uint16_t flags = 0) {
+    string header(HEADER_SIZE, '\0');
+    memcpy(&header[0], CONTAINER_MAGIC, 4);
+    put_u16(&header[4], CONTAINER_VERSION);
+    put_u16(&header[6], flags);
+    put_u32(&header[8], chunk_size);
+    return header;
+}
+
+struct ContainerHeader {
+    uint16_t flags;
+    size_t chunk_size;
+};
+
+// Validates the header and returns its flags and chunk size
+ContainerHeader check_container_header(const char* header) {
+    if (memcmp(header, CONTAINER_MAGIC, 4) != 0)
+        throw runtime_error("Not a compressed container.");
+    if (get_u16(header + 4) != CONTAINER_VERSION)
+        throw runtime_error("Unsupported container version.");
+    return {get_u16(header + 6), get_u32(header + 8)};
+}
+
+ContainerHeader read_container_header(istream& in) {
+    char header[HEADER_SIZE];
+    in.read(header, HEADER_SIZE);
+    if (in.gcount() != (streamsize)HEADER_SIZE)
+        throw runtime_error("Not a compressed container.");
+    return check_container_header(header);
+}
+
+// Builds the trailing index table, any extra section, and the footer
+string container_index(uint64_t index_offset, const vector<IndexEntry>& index,
+                       const string& extra = string()) {
+    string table(INDEX_HEADER_SIZE + index.size() * INDEX_ENTRY_SIZE + extra.size() + FOOTER_SIZE, '\0');
+    char* p = &table[0];
+    memcpy(p, INDEX_MAGIC, 4);
+    put_u32(p + 4, index.size());
+    put_u32(p + 12, extra.size());
+    p += INDEX_HEADER_SIZE;
+    for (const IndexEntry& e : index) {
+        put_u64(p, e.offset);
+        put_u32(p + 8, e.compressed_size);
+        put_u32(p + 12, e.raw_size);
+        p += INDEX_ENTRY_SIZE;
+    }
+    put_u32(&table[8], chunk_checksum(&table[INDEX_HEADER_SIZE], index.size() * INDEX_ENTRY_SIZE));
+    memcpy(p, extra.data(), extra.size());
+    p += extra.size();
+    put_u64(p, index_offset);
+    put_u32(p + 8, index.size());
+    memcpy(p + 12, FOOTER_MAGIC, 4);
+    return table;
+}
+
+// Decodes `count` entries of an index table held in memory, and copies out
+// the extra section that follows them when `extra` is given. Entries
+// claiming more than `chunk_size` bytes are rejected.
+vector<IndexEntry> parse_index_table(const char* table, size_t size, uint32_t count, size_t chunk_size,
+                                     string* extra = nullptr) {
+    size_t entries_size = (size_t)count * INDEX_ENTRY_SIZE;
+    if (size < INDEX_HEADER_SIZE + entries_size ||
+        size - INDEX_HEADER_SIZE - entries_size < get_u32(table + 12) ||
+        memcmp(table, INDEX_MAGIC, 4) != 0 ||
+        get_u32(table + 4) != count ||
+        get_u32(table + 8) != chunk_checksum(table + INDEX_HEADER_SIZE, entries_size))
+        throw runtime_error("Corrupted compressed data: bad index.");
+    vector<IndexEntry> index(count);
+    const char* p = table + INDEX_HEADER_SIZE;
+    for (IndexEntry& e : index) {
+        e.offset = get_u64(p);
+        e.compressed_size = get_u32(p + 8);
+        e.raw_size = get_u32(p + 12);
+        if (e.raw_size > chunk_size || e.compressed_size > chunk_size)
+            throw runtime_error("Corrupted compressed data: bad index.");
+        p += INDEX_ENTRY_SIZE;
+    }
+    if (extra) extra->assign(p, get_u32(table + 12));
+    return index;
+}
+
+// Loads the index table through the footer at the end of the container
+vector<IndexEntry> read_container_index(istream& in, string* extra = nullptr) {
+    in.clear();
+    in.seekg(0);
+    size_t chunk_size = read_container_header(in).chunk_size;
+    char footer[FOOTER_SIZE];
+    in.seekg(-(streamoff)FOOTER_SIZE, ios::end);
+    uint64_t footer_offset = in.tellg();
+    in.read(footer, FOOTER_SIZE);
+    if (in.gcount() != (streamsize)FOOTER_SIZE || memcmp(footer + 12, FOOTER_MAGIC, 4) != 0)
+        throw runtime_error("Corrupted compressed data: missing index.");
+    uint64_t index_offset = get_u64(footer);
+    uint32_t count = get_u32(footer + 8);
+
+    // The table fills the space between its offset and the footer exactly;
+    // checking that first keeps a bad count or extra size from allocating
+    uint64_t entries_size = (uint64_t)count * INDEX_ENTRY_SIZE;
+    if (index_offset < HEADER_SIZE || index_offset > footer_offset ||
+        footer_offset - index_offset < INDEX_HEADER_SIZE + entries_size)
+        throw runtime_error("Corrupted compressed data: bad index.");
+    string table(INDEX_HEADER_SIZE, '\0');
+    in.seekg(index_offset);
+    in.read(&table[0], INDEX_HEADER_SIZE);
+    if (in.gcount() != (streamsize)INDEX_HEADER_SIZE ||
+        footer_offset - index_offset != INDEX_HEADER_SIZE + entries_size + get_u32(&table[12]))
+        throw runtime_error("Corrupted compressed data: bad index.");
+    table.resize(footer_offset - index_offset);
+    in.read(&table[INDEX_HEADER_SIZE], table.size() - INDEX_HEADER_SIZE);
+    if ((size_t)in.gcount() != table.size() - INDEX_HEADER_SIZE)
+        throw runtime_error("Corrupted compressed data: bad index.");
+    return parse_index_table(table.data(), table.size(), count, chunk_size, extra);
+}
+
+// Same as above for a container that is already in memory
+vector<IndexEntry> read_container_index(const char* data, size_t size) {
+    if (size < HEADER_SIZE + FOOTER_SIZE) throw runtime_error("Not a compressed container.");
+    size_t chunk_size = check_container_header(data).chunk_size;
+    const char* footer = data + size - FOOTER_SIZE;
+    if (memcmp(footer + 12, FOOTER_MAGIC, 4) != 0)
+        throw runtime_error("Corrupted compressed data: missing index.");
+    uint64_t index_offset = get_u64(footer);
+    if (index_offset > size - FOOTER_SIZE)
+        throw runtime_error("Corrupted compressed data: bad index.");
+    return parse_index_table(data + index_offset, size - FOOTER_SIZE - index_offset,
+                             get_u32(footer + 8), chunk_size);
+}
+
+#ifdef TASK2_POSIX
+// Read-only memory map of an input file. Chunks are handed out as views into
+// the mapping, so the kernel's page cache is the only copy of the input.
+class MappedFile {
+    int fd = -1;
+    const char* base = nullptr;
+    size_t length = 0;
+
+public:
+    explicit MappedFile(const string& path) {
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw runtime_error("Error opening input file.");
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw runtime_error("Error opening input file.");
+        }
+        length = st.st_size;
+        if (length == 0) return;
+        void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            throw runtime_error("Error mapping input file.");
+        }
+        base = (const char*)p;
+        madvise(p, length, MADV_SEQUENTIAL);
+    }
+
+    ~MappedFile() {
+        if (base) munmap((void*)base, length);
+        close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return base; }
+    size_t size() const { return length; }
+
+    // View of up to `len` bytes at `offset`, clipped to the end of the file
+    string_view slice(uint64_t offset, size_t len) const {
+        if (offset >= length) return string_view();
+        return string_view(base + offset, min<uint64_t>(len, length - offset));
+    }
+
+    // Asks the kernel to start reading a range the workers will need soon
+    void prefetch(uint64_t offset, size_t len) const {
+        if (!base || offset >= length) return;
+        static const uint64_t page = sysconf(_SC_PAGESIZE);
+        uint64_t begin = offset & ~(page - 1);
+        uint64_t end = min<uint64_t>(offset + len, length);
+        madvise((void*)(base + begin), end - begin, MADV_WILLNEED);
+    }
+};
+
+// Output file written with pwrite() at explicit offsets, optionally pre-sized
+class OutputFile {
+    int fd = -1;
+
+public:
+    explicit OutputFile(const string& path, uint64_t size = 0) {
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) throw runtime_error("Error opening output file.");
+        if (size && ftruncate(fd, size) != 0) {
+            close(fd);
+            throw runtime_error("Error sizing output file.");
+        }
+    }
+
+    ~OutputFile() { close(fd); }
+
+    OutputFile(const OutputFile&) = delete;
+    OutputFile& operator=(const OutputFile&) = delete;
+
+    void write_at(string_view data, uint64_t offset) {
+        while (!data.empty()) {
+            ssize_t n = pwrite(fd, data.data(), data.size(), offset);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) throw runtime_error("Error writing output file.");
+            data.remove_prefix(n);
+            offset += n;
+        }
+    }
+};
+
+// Drops a file's clean pages from the page cache so the next read is cold
+void evict_page_cache(const string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+#endif
+
+// Lets a thread sleep until a lock-free condition becomes true. The waiter
+// spins and yields briefly, then registers itself and sleeps on a condition variable;
+// wake() only touches the mutex when a waiter is registered, so the common
+// signal is one atomic load. Both sides use seq_cst: either the waiter sees
+// the new state, or the signaler sees the waiter.
+class Parker {
+    mutex m;
+    condition_variable cv;
+    atomic<int> sleepers{0};
+    atomic<uint64_t> parks{0};
+    atomic<uint64_t> locked_wakes{0};
+
+public:
+    template <class Ready>
+    void wait(Ready ready) {
+        for (int spin = 0; spin < 256; ++spin) {
+            if (ready()) return;
+#if defined(__x86_64__) || defined(__i386__)
+            _mm_pause();
+#endif
+        }
+        for (int spin = 0; spin < 64; ++spin) {
+            if (ready()) return;
+            this_thread::yield();
+        }
+        while (!ready()) {
+            unique_lock<mutex> lock(m);
+            sleepers++;
+            if (!ready()) {
+                parks++;
+                cv.wait(lock);
+            }
+            sleepers--;
+        }
+    }
+
+    void wake() {
+        if (sleepers.load() == 0) return;
+        locked_wakes++;
+        lock_guard<mutex> lock(m);
+        cv.notify_all();
+    }
+
+    uint64_t park_count() const { return parks; }
+    uint64_t locked_wake_count() const { return locked_wakes; }
+};
+
+// Three-stage streaming pipeline: the calling thread reads chunks, pool workers
+// transform them, and a writer thread emits results in chunk order. Chunks live
+// in a ring of `max_in_flight` slots, so the reader blocks once that many are
+// unwritten and memory stays flat regardless of input size.
+//
+// No lock is shared between jobs: each job owns its slot and publishes it by
+// storing the chunk number in the slot's `done` flag. The writer and reader
+// only sleep (through a Parker) when they have run ahead of the workers.
+class ChunkPipeline {
+public:
+    // Fills `input` with the next chunk; it may point into `buffer` or at
+    // memory the caller keeps alive (a mapped file) to avoid a copy
+    using ReadFn = function<bool(string& buffer, string_view& input)>;
+    using TransformFn = function<void(string_view, string&)>;
+    using WriteFn = function<void(const string&)>;
+
+private:
+    struct Slot {
+        string buffer;
+        string_view input;
+        string output;
+        atomic<size_t> done{0};  // chunk number + 1 once `output` holds its result
+    };
+
+    ThreadPool& pool;
+    vector<Slot> slots;
+    Parker writer_parker;  // the writer waits for the next slot in order
+    Parker reader_parker;  // the reader waits for a free slot
+    atomic<size_t> chunks_read{0};
+    atomic<size_t> chunks_written{0};
+    atomic<bool> reading_done{false};
+    atomic<bool> failed{false};
+    mutex error_mutex;
+    exception_ptr error;
+
+    void fail(exception_ptr e) {
+        {
+            lock_guard<mutex> lock(error_mutex);
+            if (!error) error = e;
+        }
+        failed = true;
+        writer_parker.wake();
+        reader_parker.wake();
+    }
+
+    void writer_loop(const WriteFn& write) {
+        for (size_t i = 0;; ++i) {
+            Slot& slot = slots[i % slots.size()];
+            auto ready = [&] { return slot.done == i + 1; };
+            writer_parker.wait([&] {
+                return ready() || failed || (reading_done && i == chunks_read);
+            });
+            if (failed || !ready()) return;
+            try {
+                write(slot.output);
+            } catch (...) {
+                fail(current_exception());
+                return;
+            }
+            chunks_written++;
+            reader_parker.wake();
+        }
+    }
+
+public:
+    ChunkPipeline(ThreadPool& p, size_t max_in_flight)
+        : pool(p), slots(max_in_flight ? max_in_flight : 1) {}
 
+    // Runs the pipeline to completion and returns the number of chunks processed
+    size_t run(const ReadFn& read, const TransformFn& transform, const WriteFn& write) {
+        thread writer(&ChunkPipeline::writer_loop, this, cref(write));
+        try {
+            for (size_t i = 0;; ++i) {
+                Slot& slot = slots[i % slots.size()];
+                reader_parker.wait([&] { return failed || i - chunks_written < slots.size(); });
+                if (failed) break;
+                if (!read(slot.buffer, slot.input)) break;
+                chunks_read++;
+                pool.submit([this, &slot, &transform, i] {
+                    try {
+                        transform(slot.input, slot.output);
+                    } catch (...) {
+                        fail(current_exception());
+                        return;
+                    }
+                    slot.done = i + 1;
+                    writer_parker.wake();
+                });
+            }
+        } catch (...) {
+            fail(current_exception());
+        }
+        reading_done = true;
+        writer_parker.wake();
+        writer.join();
+        pool.wait_idle();
+        if (error) rethrow_exception(error);
+        return chunks_read;
+    }
+
+    // Times the writer or reader had to sleep, and finished jobs that had to
+    // take a lock to wake one of them; both stay far below the chunk count
+    uint64_t park_count() const { return writer_parker.park_count() + reader_parker.park_count(); }
+    uint64_t locked_wake_count() const {
+        return writer_parker.locked_wake_count() + reader_parker.locked_wake_count();
+    }
+};
+
+// Settings shared by the compress/decompress drivers
+struct Options {
+    size_t chunk_size = 0;  // 0: pick from the input size (adaptive_chunk_size)
+    size_t split = 0;       // RLE pieces per chunk; 0: auto, 1: off
+    size_t in_flight = 0;
+    const Codec* codec = codec_for(CodecId::LZ77);
+    int level = 1;
+    bool use_mmap = false;
+    bool verbose = true;
+};
+
+const size_t MIN_CHUNK_SIZE = 64 << 10;
+const size_t MAX_CHUNK_SIZE = 4 << 20;
+
+// Chunk size for an input of known size: about four chunks per worker so the
+// pool stays balanced, as a power of two between 64 KB and 4 MB. A 2 MB input
+// on 32 threads gets 64 KB chunks and keeps every worker busy.
+size_t adaptive_chunk_size(uint64_t input_size, size_t threads) {
+    uint64_t target = input_size / (max<size_t>(threads, 1) * 4);
+    size_t chunk = MIN_CHUNK_SIZE;
+    while (chunk < target && chunk < MAX_CHUNK_SIZE) chunk <<= 1;
+    return chunk;
+}
+
+// Fills in the automatic settings for one input. When even the smallest
+// chunks leave workers idle, RLE chunks are also split internally.
+Options resolve_options(Options opts, const string& input_path, size_t threads) {
+    error_code ec;
+    uint64_t size = 0;
+    bool known = input_path != "-" && filesystem::is_regular_file(input_path, ec);
+    if (known) size = filesystem::file_size(input_path, ec);
+    if (opts.chunk_size == 0) opts.chunk_size = known ? adaptive_chunk_size(size, threads) : CHUNK_SIZE;
+    if (opts.split == 0) {
+        uint64_t chunks = known ? max<uint64_t>(1, (size + opts.chunk_size - 1) / opts.chunk_size) : threads;
+        opts.split = chunks < threads ? (threads + chunks - 1) / chunks : 1;
+    }
+    return opts;
+}
+
+// Opens `path` for binary reading; "-" means standard input
+istream& open_input(const string& path, ifstream& file) {
+    if (path == "-") return cin;
+    file.open(path, ios::binary);
+    if (!file) throw runtime_error("Error opening input file: " + path);
+    return file;
+}
+
+// Opens `path` for binary writing; "-" means standard output
+ostream& open_output(const string& path, ofstream& file) {
+    if (path == "-") return cout;
+    file.open(path, ios::binary);
+    if (!file) throw runtime_error("Error opening output file: " + path);
+    return file;
+}
+
+// Receives each finished frame or decoded chunk with its output offset
+using EmitFn = function<void(const string&, uint64_t)>;
+
+// Core of compress(): runs the chunks produced by `read` through the codec and
+// emits each frame at its container offset. Returns the index table.
+vector<IndexEntry> compress_frames(ThreadPool& pool, const Options& opts,
+                                   const ChunkPipeline::ReadFn& read, const EmitFn& emit) {
+    uint64_t offset = HEADER_SIZE;
+    vector<IndexEntry> index;
+    const Codec& codec = *opts.codec;
+    int level = opts.level;
+    ThreadPool* split_pool = opts.split > 1 ? &pool : nullptr;
+    size_t split = opts.split;
+    ChunkPipeline pipeline(pool, opts.in_flight);
+    pipeline.run(
+        read,
+        [&codec, level, split_pool, split](string_view chunk, string& frame) {
+            compress_chunk(chunk, frame, codec, level, split_pool, split);
+        },
+        [&](const string& frame) {
+            index.push_back({offset, get_u32(&frame[0]), get_u32(&frame[4])});
+            emit(frame, offset);
+            offset += frame.size();
+        });
+    return index;
+}
+
+// Core of compress() for input already in memory (mapped or generated)
+vector<IndexEntry> compress_view(ThreadPool& pool, const Options& opts, string_view data,
+                                 const EmitFn& emit, const function<void(uint64_t)>& prefetch) {
+    uint64_t pos = 0;
+    return compress_frames(pool, opts,
+        [&](string&, string_view& chunk) {
+            chunk = data.substr(pos, opts.chunk_size);
+            pos += chunk.size();
+            if (prefetch) prefetch(pos);
+            return !chunk.empty();
+        },
+        emit);
+}
+
+// Core of decompress() for a container in memory: frames are located through
+// the index, and every chunk's output offset is known before it is decoded
+void decompress_view(ThreadPool& pool, const Options& opts, string_view container,
+                     const vector<IndexEntry>& index, const EmitFn& emit,
+                     const function<void(const IndexEntry&)>& prefetch) {
+    size_t chunk_size = check_container_header(container.data()).chunk_size;
+    size_t next = 0, written = 0;
+    uint64_t out_offset = 0;
+    ChunkPipeline pipeline(pool, opts.in_flight);
+    pipeline.run(
+        [&](string&, string_view& frame) {
+            if (next == index.size()) return false;
+            const IndexEntry& e = index[next++];
+            frame = container.substr(min<uint64_t>(e.offset, container.size()),
+                                     FRAME_HEADER_SIZE + e.compressed_size);
+            if (prefetch && next + opts.in_flight <= index.size())
+                prefetch(index[next + opts.in_flight - 1]);
+            return true;
+        },
+        [&](string_view frame, string& result) { decompress_chunk(frame, result, chunk_size); },
+        [&](const string& result) {
+            // Callers place chunks by the index's sizes, so a frame that
+            // decodes to any other length must not be written
+            if (result.size() != index[written++].raw_size)
+                throw runtime_error("Corrupted compressed data: chunk size does not match index.");
+            emit(result, out_offset);
+            out_offset += result.size();
+        });
+    uint64_t total = 0;
+    for (const IndexEntry& e : index) total += e.raw_size;
+    if (out_offset != total) throw runtime_error("Corrupted compressed data: index does not match frames.");
+}
+
+// Compress using the streaming pipeline; returns the elapsed seconds
+double compress(const string& input_path, const string& output_path, ThreadPool& pool,
+                const Options& requested) {
+    Options opts = resolve_options(requested, input_path, pool.size());
+    pool.reset_stats();
+    reset_codec_stats();
     auto start = chrono::high_resolution_clock::now();
-    for (size_t i = 0; i < chunks.size(); ++i)
-        threads.emplace_back(decompress_chunk, cref(chunks[i]), ref(results), i);
-    for (thread& t : threads) t.join();
+
+    if (opts.use_mmap && (input_path == "-" || output_path == "-"))
+        throw runtime_error("--mmap needs file paths, not standard input/output.");
+    if (opts.use_mmap) {
+#ifdef TASK2_POSIX
+        MappedFile in(input_path);
+        OutputFile out(output_path);
+        out.write_at(container_header(opts.chunk_size), 0);
+        in.prefetch(0, opts.in_flight * opts.chunk_size);
+        vector<IndexEntry> index = compress_view(pool, opts, string_view(in.data(), in.size()),
+            [&](const string& frame, uint64_t offset) { out.write_at(frame, offset); },
+            [&](uint64_t pos) {
+                // Keep the kernel a full window of chunks ahead of the workers
+                in.prefetch(pos + (opts.in_flight - 1) * opts.chunk_size, opts.chunk_size);
+            });
+        uint64_t index_offset = index.empty() ? HEADER_SIZE
+            : index.back().offset + FRAME_HEADER_SIZE + index.back().compressed_size;
+        out.write_at(container_index(index_offset, index), index_offset);
+#else
+        throw runtime_error("Memory-mapped input is not supported on this platform.");
+#endif
+    } else {
+        // Frames are flushed as they complete, so in a shell pipeline output
+        // starts flowing while input is still arriving
+        ifstream in_file;
+        ofstream out_file;
+        istream& in = open_input(input_path, in_file);
+        ostream& out = open_output(output_path, out_file);
+        out << container_header(opts.chunk_size);
+        uint64_t end_offset = HEADER_SIZE;
+        vector<IndexEntry> index = compress_frames(pool, opts,
+            [&](string& buffer, string_view& chunk) {
+                bool more = read_next_chunk(in, buffer, opts.chunk_size);
+                chunk = buffer;
+                return more;
+            },
+            [&](const string& frame, uint64_t offset) {
+                out.write(frame.data(), frame.size());
+                out.flush();
+                end_offset = offset + frame.size();
+            });
+        out << container_index(end_offset, index);
+        out.flush();
+        if (!out) throw runtime_error("Error writing output file.");
+    }
     auto end = chrono::high_resolution_clock::now();
 
-    write_chunks_to_file(output_path, results);
+    chrono::duration<double> duration = end - start;
+    if (opts.verbose) {
+        cerr << "Multi-threaded compression completed in " << duration.count() << " seconds ("
+             << opts.chunk_size / 1024 << " KB chunks";
+        if (opts.split > 1 && opts.codec->id() == CodecId::RLE) cerr << ", " << opts.split << "-way split";
+        cerr << ").\n";
+        report_codec_stats(cerr);
+        pool.report(cerr);
+    }
+    return duration.count();
+}
+
+// Decompress using the streaming pipeline; returns the elapsed seconds
+double decompress(const string& input_path, const string& output_path, ThreadPool& pool,
+                  const Options& opts) {
+    pool.reset_stats();
+    reset_codec_stats();
+    auto start = chrono::high_resolution_clock::now();
+
+    if (opts.use_mmap && (input_path == "-" || output_path == "-"))
+        throw runtime_error("--mmap needs file paths, not standard input/output.");
+    if (opts.use_mmap) {
+#ifdef TASK2_POSIX
+        // The index gives every chunk's raw size, so the output can be sized
+        // up front and each result written at its final offset
+        MappedFile in(input_path);
+        vector<IndexEntry> index = read_container_index(in.data(), in.size());
+        uint64_t total = 0;
+        for (const IndexEntry& e : index) total += e.raw_size;
+        OutputFile out(output_path, total);
+        decompress_view(pool, opts, string_view(in.data(), in.size()), index,
+            [&](const string& result, uint64_t offset) { out.write_at(result, offset); },
+            [&](const IndexEntry& e) { in.prefetch(e.offset, FRAME_HEADER_SIZE + e.compressed_size); });
+#else
+        throw runtime_error("Memory-mapped input is not supported on this platform.");
+#endif
+    } else {
+        // Frames are decoded in order as they arrive; the trailing index is
+        // not needed, so this also works on a pipe
+        ifstream in_file;
+        ofstream out_file;
+        istream& in = open_input(input_path, in_file);
+        ostream& out = open_output(output_path, out_file);
+        size_t chunk_size = read_container_header(in).chunk_size;
+        ChunkPipeline pipeline(pool, opts.in_flight);
+        pipeline.run(
+            [&](string& buffer, string_view& frame) {
+                bool more = read_next_frame(in, buffer, chunk_size);
+                frame = buffer;
+                return more;
+            },
+            [&](string_view frame, string& result) { decompress_chunk(frame, result, chunk_size); },
+            [&](const string& result) {
+                out.write(result.data(), result.size());
+                out.flush();
+            });
+        if (!out) throw runtime_error("Error writing output file.");
+    }
+    auto end = chrono::high_resolution_clock::now();
 
     chrono::duration<double> duration = end - start;
-    cout << "Multi-threaded decompression completed in " << duration.count() << " seconds.\n";
+    if (opts.verbose) {
+        cerr << "Multi-threaded decompression completed in " << duration.count() << " seconds.\n";
+        report_codec_stats(cerr);
+        pool.report(cerr);
+    }
+    return duration.count();
+}
+
+// Extracts bytes [offset, offset + length) of the original file, decoding only
+// the chunks that overlap the range
+void extract_range(const string& input_path, uint64_t offset, uint64_t length, ostream& out) {
+    ifstream in(input_path, ios::binary);
+    if (!in) throw runtime_error("Error opening input file.");
+    vector<IndexEntry> index = read_container_index(in);
+    // Keeps offset + length from wrapping; a range past the end is cut short
+    length = min(length, UINT64_MAX - offset);
+
+    uint64_t chunk_start = 0;
+    string frame, raw;
+    for (const IndexEntry& e : index) {
+        uint64_t chunk_end = chunk_start + e.raw_size;
+        if (chunk_end > offset && chunk_start < offset + length) {
+            frame.resize(FRAME_HEADER_SIZE + e.compressed_size);
+            in.seekg(e.offset);
+            in.read(&frame[0], frame.size());
+            if ((size_t)in.gcount() != frame.size())
+                throw runtime_error("Corrupted compressed data: truncated frame.");
+            decompress_chunk(frame, raw, e.raw_size);
+            if (raw.size() != e.raw_size)
+                throw runtime_error("Corrupted compressed data: chunk size does not match index.");
+            uint64_t from = max(offset, chunk_start) - chunk_start;
+            uint64_t to = min(offset + length, chunk_end) - chunk_start;
+            out.write(raw.data() + from, to - from);
+        }
+        if (chunk_end >= offset + length) break;
+        chunk_start = chunk_end;
+    }
 }
 
 // Validate if decompressed file matches original
@@ -119,67 +1653,782 @@ bool validate(const string& original_path, const string& decompressed_path) {
     if (!f1 || !f2) return false;
 
     string b1, b2;
-    while (!f1.eof() || !f2.eof()) {
-        char buf1[CHUNK_SIZE], buf2[CHUNK_SIZE];
-        f1.read(buf1, CHUNK_SIZE);
-        f2.read(buf2, CHUNK_SIZE);
-        if (f1.gcount() != f2.gcount() || memcmp(buf1, buf2, f1.gcount()) != 0)
-            return false;
+    while (read_next_chunk(f1, b1, CHUNK_SIZE) | read_next_chunk(f2, b2, CHUNK_SIZE))
+        if (b1 != b2) return false;
+    return true;
+}
+
+// Reads the rest of the index table after read_next_frame() stopped at its
+// header, without seeking, so it also works on standard input. The header
+// started at `index_offset`, and the footer must point back there.
+vector<IndexEntry> read_index_after_frames(istream& in, const string& index_header,
+                                           uint64_t index_offset, size_t chunk_size) {
+    if (index_header.size() < INDEX_HEADER_SIZE)
+        throw runtime_error("Corrupted compressed data: missing index.");
+    uint32_t count = get_u32(&index_header[4]);
+    uint64_t size = INDEX_HEADER_SIZE + (uint64_t)count * INDEX_ENTRY_SIZE +
+                    get_u32(&index_header[12]) + FOOTER_SIZE;
+    // The sizes are unchecked so far; grow the table only as far as the
+    // stream actually goes
+    string table = index_header.substr(0, INDEX_HEADER_SIZE);
+    while (table.size() < size) {
+        size_t have = table.size();
+        table.resize(have + min<uint64_t>(size - have, CHUNK_SIZE));
+        in.read(&table[have], table.size() - have);
+        if ((size_t)in.gcount() != table.size() - have)
+            throw runtime_error("Corrupted compressed data: missing index.");
     }
+    const char* footer = table.data() + table.size() - FOOTER_SIZE;
+    if (memcmp(footer + 12, FOOTER_MAGIC, 4) != 0)
+        throw runtime_error("Corrupted compressed data: missing index.");
+    if (get_u64(footer) != index_offset || get_u32(footer + 8) != count)
+        throw runtime_error("Corrupted compressed data: footer does not match index.");
+    return parse_index_table(table.data(), table.size() - FOOTER_SIZE, count, chunk_size);
+}
+
+// Verifies a container on its own in a single pass: every frame is decoded
+// and its CRC32C checked, the output is discarded and no original is needed
+bool verify(const string& input_path, ThreadPool& pool, const Options& opts) {
+    uint64_t chunks = 0, bytes = 0;
+    try {
+        ifstream in_file;
+        istream& in = open_input(input_path, in_file);
+        size_t chunk_size = read_container_header(in).chunk_size;
+        string index_header;
+        uint64_t index_offset = HEADER_SIZE;
+        ChunkPipeline pipeline(pool, opts.in_flight);
+        pipeline.run(
+            [&](string& buffer, string_view& frame) {
+                bool more = read_next_frame(in, buffer, chunk_size);
+                if (more) index_offset += buffer.size();
+                else index_header = buffer;
+                frame = buffer;
+                return more;
+            },
+            [&](string_view frame, string& result) { decompress_chunk(frame, result, chunk_size); },
+            [&](const string& result) {
+                chunks++;
+                bytes += result.size();
+            });
+        // The index must agree with what the frames actually held
+        vector<IndexEntry> index = read_index_after_frames(in, index_header, index_offset, chunk_size);
+        uint64_t indexed = 0;
+        for (const IndexEntry& e : index) indexed += e.raw_size;
+        if (index.size() != chunks || indexed != bytes)
+            throw runtime_error("Corrupted compressed data: index does not match frames.");
+    } catch (const exception& e) {
+        cerr << input_path << ": verification failed: " << e.what() << "\n";
+        return false;
+    }
+    if (opts.verbose)
+        cerr << input_path << ": " << chunks << " chunks, " << bytes << " bytes, CRC32C ("
+             << crc32c_name << ") OK.\n";
     return true;
 }
 
-// Benchmark single-threaded vs multithreaded compression
-void benchmark(const string& input_path) {
-    auto chunks = read_file_chunks(input_path);
+// Archive file table, stored as the index's extra section:
+//   magic "TK2F", u32 file count, u32 CRC32C of the entries, u32 reserved,
+//   then per file u32 path length, path (relative, '/'-separated),
+//   u64 size, u32 first chunk, u32 chunk count
+// A file's chunks are consecutive, so any single file can be decoded through
+// the index without touching the others.
+const char FILE_TABLE_MAGIC[4] = {'T', 'K', '2', 'F'};
+const size_t FILE_TABLE_HEADER_SIZE = 16;
 
-    // Single-threaded
-    vector<string> single_result(chunks.size());
-    auto start_single = chrono::high_resolution_clock::now();
-    for (size_t i = 0; i < chunks.size(); ++i)
-        single_result[i] = rle_compress(chunks[i]);
-    auto end_single = chrono::high_resolution_clock::now();
+struct FileEntry {
+    string path;
+    uint64_t size;
+    uint32_t first_chunk;
+    uint32_t chunk_count;
+};
 
-    // Multi-threaded
-    vector<string> multi_result(chunks.size());
-    vector<thread> threads;
-    auto start_multi = chrono::high_resolution_clock::now();
-    for (size_t i = 0; i < chunks.size(); ++i)
-        threads.emplace_back(compress_chunk, cref(chunks[i]), ref(multi_result), i);
-    for (thread& t : threads) t.join();
-    auto end_multi = chrono::high_resolution_clock::now();
+string encode_file_table(const vector<FileEntry>& files) {
+    string table(FILE_TABLE_HEADER_SIZE, '\0');
+    memcpy(&table[0], FILE_TABLE_MAGIC, 4);
+    put_u32(&table[4], files.size());
+    for (const FileEntry& f : files) {
+        char fixed[16];
+        put_u32(fixed, f.path.size());
+        table.append(fixed, 4);
+        table += f.path;
+        put_u64(fixed, f.size);
+        put_u32(fixed + 8, f.first_chunk);
+        put_u32(fixed + 12, f.chunk_count);
+        table.append(fixed, 16);
+    }
+    put_u32(&table[8], chunk_checksum(&table[FILE_TABLE_HEADER_SIZE], table.size() - FILE_TABLE_HEADER_SIZE));
+    return table;
+}
 
-    chrono::duration<double> t_single = end_single - start_single;
-    chrono::duration<double> t_multi = end_multi - start_multi;
+vector<FileEntry> parse_file_table(const string& table, size_t chunk_count) {
+    if (table.size() < FILE_TABLE_HEADER_SIZE || memcmp(&table[0], FILE_TABLE_MAGIC, 4) != 0 ||
+        get_u32(&table[8]) != chunk_checksum(&table[FILE_TABLE_HEADER_SIZE],
+                                             table.size() - FILE_TABLE_HEADER_SIZE))
+        throw runtime_error("Corrupted archive: bad file table.");
+    vector<FileEntry> files(get_u32(&table[4]));
+    size_t pos = FILE_TABLE_HEADER_SIZE;
+    for (FileEntry& f : files) {
+        if (table.size() - pos < 4) throw runtime_error("Corrupted archive: bad file table.");
+        size_t len = get_u32(&table[pos]);
+        if (table.size() - pos - 4 < len + 16) throw runtime_error("Corrupted archive: bad file table.");
+        f.path = table.substr(pos + 4, len);
+        pos += 4 + len;
+        f.size = get_u64(&table[pos]);
+        f.first_chunk = get_u32(&table[pos + 8]);
+        f.chunk_count = get_u32(&table[pos + 12]);
+        pos += 16;
+        if ((uint64_t)f.first_chunk + f.chunk_count > chunk_count)
+            throw runtime_error("Corrupted archive: file table points past the index.");
+    }
+    return files;
+}
 
-    cout << "\n Benchmark:\n";
-    cout << "Single-threaded time: " << t_single.count() << " sec\n";
-    cout << "Multi-threaded time: " << t_multi.count() << " sec\n";
-    cout << "Speedup: " << t_single.count() / t_multi.count() << "x faster\n";
+// Loads an archive's index and file table, leaving `in` at the first frame
+vector<IndexEntry> read_archive_index(istream& in, vector<FileEntry>& files, size_t* chunk_size = nullptr) {
+    string extra;
+    vector<IndexEntry> index = read_container_index(in, &extra);
+    in.clear();
+    in.seekg(0);
+    ContainerHeader header = read_container_header(in);
+    if (!(header.flags & FLAG_ARCHIVE)) throw runtime_error("Not an archive.");
+    if (chunk_size) *chunk_size = header.chunk_size;
+    files = parse_file_table(extra, index.size());
+    return index;
 }
 
-int main() {
-    string input = "input.txt";
-    string compressed = "compressed.rle";
-    string decompressed = "output.txt";
+// Packs every regular file under `dir` into one archive. Files that fit in a
+// chunk become a single job; larger files are split into chunk-sized jobs.
+// All of them share one pool and one pipeline, so there is no per-file setup.
+void archive(const string& dir, const string& output_path, ThreadPool& pool, Options opts) {
+    namespace fs = std::filesystem;
+    if (opts.chunk_size == 0) opts.chunk_size = CHUNK_SIZE;
+    auto start = chrono::steady_clock::now();
+    pool.reset_stats();
+    reset_codec_stats();
 
-    try {
-        // Run compression
-        compress(input, compressed);
+    vector<FileEntry> files;
+    uint32_t chunks = 0;
+    for (const fs::directory_entry& entry : fs::recursive_directory_iterator(dir)) {
+        if (!entry.is_regular_file()) continue;
+        FileEntry f;
+        f.path = fs::relative(entry.path(), dir).generic_string();
+        f.size = entry.file_size();
+        f.first_chunk = chunks;
+        f.chunk_count = (f.size + opts.chunk_size - 1) / opts.chunk_size;
+        chunks += f.chunk_count;
+        files.push_back(f);
+    }
+    uint64_t total = 0;
+    for (const FileEntry& f : files) total += f.size;
+
+    ofstream out_file;
+    ostream& out = open_output(output_path, out_file);
+    out << container_header(opts.chunk_size, FLAG_ARCHIVE);
+    size_t file = 0;
+    uint64_t file_pos = 0, end_offset = HEADER_SIZE;
+    ifstream in;
+    vector<IndexEntry> index = compress_frames(pool, opts,
+        [&](string& buffer, string_view& chunk) {
+            while (file < files.size() && file_pos == files[file].size) {
+                file++;
+                file_pos = 0;
+                in.close();
+            }
+            if (file == files.size()) return false;
+            if (!in.is_open()) {
+                in.open(fs::path(dir) / files[file].path, ios::binary);
+                if (!in) throw runtime_error("Error opening " + files[file].path);
+            }
+            size_t want = min<uint64_t>(opts.chunk_size, files[file].size - file_pos);
+            buffer.resize(want);
+            in.read(&buffer[0], want);
+            if ((size_t)in.gcount() != want)
+                throw runtime_error(files[file].path + " changed while being archived.");
+            file_pos += want;
+            chunk = buffer;
+            return true;
+        },
+        [&](const string& frame, uint64_t offset) {
+            out.write(frame.data(), frame.size());
+            end_offset = offset + frame.size();
+        });
+    out << container_index(end_offset, index, encode_file_table(files));
+    out.flush();
+    if (!out) throw runtime_error("Error writing output file.");
+
+    if (opts.verbose) {
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cerr << "Archived " << files.size() << " files (" << index.size() << " chunks) in "
+             << seconds << " seconds: " << files.size() / seconds << " files/s, "
+             << total / 1e6 / seconds << " MB/s.\n";
+        report_codec_stats(cerr);
+        pool.report(cerr);
+    }
+}
+
+void list_archive(const string& archive_path, ostream& os) {
+    ifstream in(archive_path, ios::binary);
+    if (!in) throw runtime_error("Error opening input file: " + archive_path);
+    vector<FileEntry> files;
+    vector<IndexEntry> index = read_archive_index(in, files);
+    for (const FileEntry& f : files) {
+        uint64_t stored = 0;
+        for (uint32_t c = f.first_chunk; c < f.first_chunk + f.chunk_count; ++c)
+            stored += FRAME_HEADER_SIZE + index[c].compressed_size;
+        os << setw(12) << f.size << ' ' << setw(12) << stored << "  " << f.path << '\n';
+    }
+}
+
+// Decodes one archived file. Only that file's frames are read, through the
+// index, and they are decoded in parallel like any other chunk stream.
+void extract_file(const string& archive_path, const string& name, const string& output_path,
+                  ThreadPool& pool, const Options& opts) {
+    ifstream in(archive_path, ios::binary);
+    if (!in) throw runtime_error("Error opening input file: " + archive_path);
+    vector<FileEntry> files;
+    size_t chunk_size;
+    vector<IndexEntry> index = read_archive_index(in, files, &chunk_size);
+    auto it = find_if(files.begin(), files.end(), [&](const FileEntry& f) { return f.path == name; });
+    if (it == files.end()) throw runtime_error("No such file in archive: " + name);
+
+    ofstream out_file;
+    ostream& out = open_output(output_path, out_file);
+    uint32_t next = it->first_chunk, end = it->first_chunk + it->chunk_count;
+    ChunkPipeline pipeline(pool, opts.in_flight);
+    pipeline.run(
+        [&](string& buffer, string_view& frame) {
+            if (next == end) return false;
+            const IndexEntry& e = index[next++];
+            buffer.resize(FRAME_HEADER_SIZE + e.compressed_size);
+            in.seekg(e.offset);
+            in.read(&buffer[0], buffer.size());
+            if ((size_t)in.gcount() != buffer.size())
+                throw runtime_error("Corrupted compressed data: truncated frame.");
+            frame = buffer;
+            return true;
+        },
+        [&](string_view frame, string& result) { decompress_chunk(frame, result, chunk_size); },
+        [&](const string& result) { out.write(result.data(), result.size()); });
+    out.flush();
+    if (!out) throw runtime_error("Error writing output file.");
+}
+
+// Restores every archived file under `dir`, streaming the frames in order
+void unpack_archive(const string& archive_path, const string& dir, ThreadPool& pool,
+                    const Options& opts) {
+    namespace fs = std::filesystem;
+    ifstream in(archive_path, ios::binary);
+    if (!in) throw runtime_error("Error opening input file: " + archive_path);
+    vector<FileEntry> files;
+    size_t chunk_size;
+    read_archive_index(in, files, &chunk_size);
+
+    // Refuse paths that would land outside `dir`
+    for (const FileEntry& f : files) {
+        fs::path p(f.path);
+        if (p.is_absolute() || find(p.begin(), p.end(), "..") != p.end())
+            throw runtime_error("Unsafe path in archive: " + f.path);
+    }
+
+    size_t file = 0;
+    uint32_t chunks_left = 0;
+    ofstream out;
+    // Opens the next output file; empty files are created on the way past
+    auto open_next = [&] {
+        out.close();
+        while (file < files.size()) {
+            fs::path target = fs::path(dir) / files[file].path;
+            fs::create_directories(target.parent_path());
+            out.open(target, ios::binary | ios::trunc);
+            if (!out) throw runtime_error("Error opening output file: " + target.string());
+            chunks_left = files[file++].chunk_count;
+            if (chunks_left) return;
+            out.close();
+        }
+    };
+    open_next();
+
+    ChunkPipeline pipeline(pool, opts.in_flight);
+    pipeline.run(
+        [&](string& buffer, string_view& frame) {
+            bool more = read_next_frame(in, buffer, chunk_size);
+            frame = buffer;
+            return more;
+        },
+        [&](string_view frame, string& result) { decompress_chunk(frame, result, chunk_size); },
+        [&](const string& result) {
+            if (chunks_left == 0) throw runtime_error("Corrupted archive: more chunks than files.");
+            out.write(result.data(), result.size());
+            if (--chunks_left == 0) {
+                if (!out) throw runtime_error("Error writing output file.");
+                open_next();
+            }
+        });
+    if (chunks_left != 0 || file != files.size())
+        throw runtime_error("Corrupted archive: missing chunks.");
+}
+
+// Synthetic corpora for the benchmark suite
+enum class Corpus { SAME, RANDOM, TEXT, RUNS };
+const Corpus ALL_CORPORA[] = {Corpus::SAME, Corpus::RANDOM, Corpus::TEXT, Corpus::RUNS};
+
+const char* corpus_name(Corpus c) {
+    switch (c) {
+    case Corpus::SAME: return "same";
+    case Corpus::RANDOM: return "random";
+    case Corpus::TEXT: return "text";
+    case Corpus::RUNS: return "runs";
+    }
+    return "unknown";
+}
+
+// Deterministic corpus of `size` bytes: one repeated byte, uniform random
+// bytes, log-like text drawn from a small vocabulary, or long byte runs
+string generate_corpus(Corpus kind, size_t size) {
+    mt19937_64 rng(42);
+    string data;
+    data.reserve(size + 64);
+    switch (kind) {
+    case Corpus::SAME:
+        data.assign(size, 'A');
+        break;
+    case Corpus::RANDOM:
+        while (data.size() < size) {
+            uint64_t v = rng();
+            data.append((const char*)&v, 8);
+        }
+        break;
+    case Corpus::TEXT: {
+        static const char* words[] = {
+            "INFO", "WARN", "ERROR", "request", "served", "in", "ms", "user", "id=",
+            "session", "GET", "POST", "/api/v1/items", "status=200", "status=404",
+            "cache", "miss", "hit", "the", "connection", "closed", "by", "peer"};
+        const size_t word_count = sizeof(words) / sizeof(words[0]);
+        while (data.size() < size) {
+            data += to_string(1700000000 + rng() % 100000);
+            for (int w = 0, n = 4 + rng() % 8; w < n; ++w) {
+                data += ' ';
+                data += words[min(rng() % word_count, rng() % word_count)];  // skew toward early words
+            }
+            data += '\n';
+        }
+        break;
+    }
+    case Corpus::RUNS:
+        while (data.size() < size) data.append(1 + rng() % 1000, (char)('a' + rng() % 4));
+        break;
+    }
+    data.resize(size);
+    return data;
+}
+
+// Parameters of a benchmark sweep
+struct BenchConfig {
+    vector<size_t> sizes = {4u << 20, 32u << 20};
+    vector<size_t> threads;
+    vector<size_t> chunk_sizes = {256u << 10, 1u << 20, 4u << 20};
+    size_t warmup = 1;
+    size_t repeats = 5;
+    bool json = false;
+};
+
+struct BenchResult {
+    string corpus;
+    size_t size;
+    string codec;
+    size_t threads;
+    size_t chunk_size;
+    string direction;
+    double ratio;
+    double median_mbps;
+    double p95_mbps;
+    size_t repeats;
+    double locks_per_chunk = 0;  // pipeline handoff rows: locked wakes per chunk
+};
+
+// Runs `fn` warmup + repeats times and returns the sorted per-run seconds
+vector<double> time_runs(size_t warmup, size_t repeats, const function<void()>& fn) {
+    for (size_t i = 0; i < warmup; ++i) fn();
+    vector<double> times;
+    for (size_t i = 0; i < max<size_t>(repeats, 1); ++i) {
+        auto start = chrono::steady_clock::now();
+        fn();
+        times.push_back(chrono::duration<double>(chrono::steady_clock::now() - start).count());
+    }
+    sort(times.begin(), times.end());
+    return times;
+}
 
-        // Run decompression
-        decompress(compressed, decompressed);
+// Throughput at the median run and at the 95th-percentile (slow tail) run
+void summarize(const vector<double>& times, size_t bytes, double& median_mbps, double& p95_mbps) {
+    size_t p95 = (size_t)ceil(0.95 * times.size()) - 1;
+    median_mbps = bytes / 1e6 / times[times.size() / 2];
+    p95_mbps = bytes / 1e6 / times[p95];
+}
+
+void print_results(const vector<BenchResult>& results, bool json, ostream& os) {
+    if (json) {
+        os << "[\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const BenchResult& r = results[i];
+            os << "  {\"corpus\": \"" << r.corpus << "\", \"size\": " << r.size
+               << ", \"codec\": \"" << r.codec << "\", \"threads\": " << r.threads
+               << ", \"chunk_size\": " << r.chunk_size << ", \"direction\": \"" << r.direction
+               << "\", \"ratio\": " << r.ratio << ", \"median_mbps\": " << r.median_mbps
+               << ", \"p95_mbps\": " << r.p95_mbps << ", \"repeats\": " << r.repeats
+               << ", \"locks_per_chunk\": " << r.locks_per_chunk << "}"
+               << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        os << "]\n";
+    } else {
+        os << "corpus,size,codec,threads,chunk_size,direction,ratio,median_mbps,p95_mbps,repeats,"
+              "locks_per_chunk\n";
+        for (const BenchResult& r : results)
+            os << r.corpus << ',' << r.size << ',' << r.codec << ',' << r.threads << ','
+               << r.chunk_size << ',' << r.direction << ',' << r.ratio << ',' << r.median_mbps
+               << ',' << r.p95_mbps << ',' << r.repeats << ',' << r.locks_per_chunk << '\n';
+    }
+}
+
+// Pipeline handoff under contention: 4 KB chunks and a plain copy as the
+// transform, so every job is dominated by publishing its result. Reports
+// chunk throughput and how often a finished job had to take a lock.
+void benchmark_pipeline_handoff(const BenchConfig& config, size_t size, size_t threads,
+                                vector<BenchResult>& results) {
+    const size_t chunk_size = 4 << 10;
+    string data = generate_corpus(Corpus::RANDOM, size);
+    ThreadPool pool(threads);
+    uint64_t chunks = 0, locked = 0;
+    vector<double> times = time_runs(config.warmup, config.repeats, [&] {
+        ChunkPipeline pipeline(pool, 2 * threads);
+        size_t pos = 0, written = 0;
+        chunks += pipeline.run(
+            [&](string&, string_view& chunk) {
+                chunk = string_view(data).substr(pos, chunk_size);
+                pos += chunk.size();
+                return !chunk.empty();
+            },
+            [](string_view chunk, string& out) { out.assign(chunk.data(), chunk.size()); },
+            [&](const string& out) { written += out.size(); });
+        locked += pipeline.locked_wake_count();
+        if (written != size) throw runtime_error("Pipeline benchmark lost data.");
+    });
+    BenchResult r{"random", size, "pipeline", threads, chunk_size, "handoff", 1, 0, 0, times.size()};
+    summarize(times, size, r.median_mbps, r.p95_mbps);
+    r.locks_per_chunk = (double)locked / max<uint64_t>(chunks, 1);
+    results.push_back(r);
+}
+
+// Benchmark suite: for every corpus and size, sweeps thread count and chunk
+// size through the in-memory pipeline in both directions. Pools are built
+// before timing starts, so thread creation is never measured. Also reports
+// the RLE run scanner alone, scalar vs the dispatched SIMD variant, and the
+// pipeline handoff under contention (see benchmark_pipeline_handoff).
+void run_benchmark_suite(const BenchConfig& config, const Options& base, ostream& os) {
+    vector<BenchResult> results;
+    vector<size_t> thread_counts = config.threads;
+    if (thread_counts.empty()) {
+        for (size_t t = 1; t < default_thread_count(); t *= 2) thread_counts.push_back(t);
+        thread_counts.push_back(default_thread_count());
+    }
+
+    for (size_t size : config.sizes) {
+        for (Corpus kind : ALL_CORPORA) {
+            string data = generate_corpus(kind, size);
+
+            for (size_t threads : thread_counts) {
+                ThreadPool pool(threads);
+                for (size_t chunk_size : config.chunk_sizes) {
+                    Options opts = base;
+                    opts.chunk_size = chunk_size;
+                    opts.in_flight = 2 * threads;
+                    opts.verbose = false;
+
+                    string container;
+                    auto compress_once = [&] {
+                        container = container_header(chunk_size);
+                        vector<IndexEntry> index = compress_view(pool, opts, data,
+                            [&](const string& frame, uint64_t) { container += frame; }, nullptr);
+                        container += container_index(container.size(), index);
+                    };
+                    vector<double> times = time_runs(config.warmup, config.repeats, compress_once);
+                    BenchResult r{corpus_name(kind), size, opts.codec->name(), threads, chunk_size,
+                                  "compress", (double)container.size() / max<size_t>(size, 1),
+                                  0, 0, times.size()};
+                    summarize(times, size, r.median_mbps, r.p95_mbps);
+                    results.push_back(r);
+
+                    vector<IndexEntry> index = read_container_index(container.data(), container.size());
+                    string restored(size, '\0');
+                    auto decompress_once = [&] {
+                        decompress_view(pool, opts, container, index,
+                            [&](const string& chunk, uint64_t offset) {
+                                memcpy(&restored[offset], chunk.data(), chunk.size());
+                            }, nullptr);
+                    };
+                    times = time_runs(config.warmup, config.repeats, decompress_once);
+                    if (restored != data) throw runtime_error("Benchmark round trip mismatch.");
+                    r.direction = "decompress";
+                    summarize(times, size, r.median_mbps, r.p95_mbps);
+                    results.push_back(r);
+                }
+            }
+
+            // RLE run scanner alone, one thread, whole corpus in one buffer
+            string scratch(rle_max_size(size), '\0');
+            size_t encoded = 0;
+            vector<pair<string, RleEncodeFn>> encoders = {{"scalar", rle_compress_scalar},
+                                                           {rle_encoder_name, rle_compress_into}};
+            for (auto& encoder : encoders) {
+                vector<double> times = time_runs(config.warmup, config.repeats, [&] {
+                    encoded = encoder.second(data.data(), size, &scratch[0]);
+                });
+                BenchResult r{corpus_name(kind), size, "rle-" + encoder.first, 1, size,
+                              "encode", (double)encoded / max<size_t>(size, 1), 0, 0, times.size()};
+                summarize(times, size, r.median_mbps, r.p95_mbps);
+                results.push_back(r);
+            }
+        }
+        for (size_t threads : thread_counts) benchmark_pipeline_handoff(config, size, threads, results);
+    }
+    print_results(results, config.json, os);
+}
+
+// Compares the ifstream and mmap input paths with a cold and a warm page cache
+void benchmark_io_paths(const string& input_path, ThreadPool& pool, const Options& opts) {
+#ifdef TASK2_POSIX
+    struct stat st;
+    if (stat(input_path.c_str(), &st) != 0) return;
+    double mb = st.st_size / 1e6;
+    string scratch_path = input_path + ".bench";
+    cout << "\n Input path benchmark:\n";
+    for (bool use_mmap : {false, true}) {
+        for (bool cold : {true, false}) {
+            if (cold) evict_page_cache(input_path);
+            Options o = opts;
+            o.use_mmap = use_mmap;
+            o.verbose = false;
+            double t = compress(input_path, scratch_path, pool, o);
+            cout << (use_mmap ? "mmap" : "ifstream") << " input, " << (cold ? "cold" : "warm")
+                 << " cache: " << t << " sec, " << mb / t << " MB/s\n";
+        }
+    }
+    remove(scratch_path.c_str());
+#endif
+}
+
+// Reads the unsigned decimal number at the start of `text`, leaving `end`
+// just past it; signs, blanks and out-of-range values are rejected
+uint64_t parse_leading_number(const string& text, const char*& end) {
+    if (text.empty() || text[0] < '0' || text[0] > '9') throw invalid_argument("Bad number: " + text);
+    char* stop;
+    errno = 0;
+    uint64_t v = strtoull(text.c_str(), &stop, 10);
+    if (errno == ERANGE) throw invalid_argument("Number out of range: " + text);
+    end = stop;
+    return v;
+}
+
+// Parses an option value that must be a plain unsigned decimal number
+uint64_t parse_number(const string& text) {
+    const char* end;
+    uint64_t v = parse_leading_number(text, end);
+    if (*end != '\0') throw invalid_argument("Bad number: " + text);
+    return v;
+}
+
+// Parses a comma-separated list of sizes; accepts K/M/G suffixes
+vector<size_t> parse_size_list(const string& text) {
+    vector<size_t> values;
+    stringstream ss(text);
+    string item;
+    while (getline(ss, item, ',')) {
+        if (item.empty()) throw invalid_argument("Bad size list: " + text);
+        const char* end;
+        uint64_t v = parse_leading_number(item, end);
+        int shift = 0;
+        if (*end == 'K' || *end == 'k') shift = 10;
+        else if (*end == 'M' || *end == 'm') shift = 20;
+        else if (*end == 'G' || *end == 'g') shift = 30;
+        if (shift) ++end;
+        if (*end != '\0' || v == 0) throw invalid_argument("Bad size list: " + text);
+        if (v > (SIZE_MAX >> shift)) throw invalid_argument("Size out of range: " + item);
+        values.push_back((size_t)v << shift);
+    }
+    if (values.empty()) throw invalid_argument("Bad size list: " + text);
+    return values;
+}
+
+void print_usage(ostream& os) {
+    os << "Usage: task2 <command> [options] [input] [output]\n"
+          "\n"
+          "Commands:\n"
+          "  compress [in] [out]        compress a file (default out: in.rle)\n"
+          "  decompress [in] [out]      restore a file (default out: in without .rle)\n"
+          "  test [in...]               check container CRCs without writing output\n"
+          "  extract OFF LEN in [out]   decode only bytes [OFF, OFF+LEN) of the original\n"
+          "  archive DIR [out]          pack a directory tree (default out: DIR.rle)\n"
+          "  list ARCHIVE               list archived files (size, stored size, path)\n"
+          "  unpack ARCHIVE [DIR]       restore every archived file under DIR (default: .)\n"
+          "  extract-file ARCHIVE PATH [out]  decode one archived file\n"
+          "  bench                      run the benchmark suite\n"
+          "  roundtrip [in]             compress, decompress and compare (default in: input.txt)\n"
+          "Use - (or omit the paths) to read standard input / write standard output.\n"
+          "\n"
+          "Options:\n"
+          "  -t, --threads N       worker threads (default: hardware concurrency)\n"
+          "  -c, --codec NAME      lz77, packbits, rle or raw (default: lz77)\n"
+          "  -l, --level N         compression effort 1-9 (default: 1)\n"
+          "  -b, --chunk-size N    chunk size, K/M suffixes allowed (default: from input\n"
+          "                        size and thread count, 64K-4M; 1M for stdin)\n"
+          "      --split N         encode each RLE chunk as N parallel pieces (default:\n"
+          "                        auto when there are fewer chunks than threads)\n"
+          "      --in-flight N     chunks held in the pipeline (default: 2 x threads)\n"
+          "      --mmap            memory-map the input and pwrite the output\n"
+          "  -v, --verbose         print timing, codec and worker reports to stderr\n"
+          "Bench options: --bench-format csv|json, --bench-sizes, --bench-threads,\n"
+          "  --bench-chunks (comma-separated lists), --bench-repeats N, --bench-warmup N\n";
+}
+
+// Default output name for a command when none is given
+string default_output(const string& command, const string& input) {
+    if (input == "-") return "-";
+    if (command == "compress") return input + ".rle";
+    const string ext = ".rle";
+    if (input.size() > ext.size() && input.compare(input.size() - ext.size(), ext.size(), ext) == 0)
+        return input.substr(0, input.size() - ext.size());
+    return input + ".out";
+}
+
+// The original demo: compress, decompress, verify and compare one file
+void roundtrip(const string& input, ThreadPool& pool, Options opts) {
+    string compressed = input + ".rle";
+    string decompressed = input + ".out";
+    opts.verbose = true;
+
+    compress(input, compressed, pool, opts);
+    decompress(compressed, decompressed, pool, opts);
+
+    // Validate result: container CRCs, then a byte comparison with the original
+    verify(compressed, pool, opts);
+    if (validate(input, decompressed))
+        cout << "Validation: Decompressed file matches original.\n";
+    else
+        cout << "Validation failed: Files differ!\n";
+
+    // Compare input paths; run the bench command for the full suite
+    benchmark_io_paths(input, pool, opts);
+}
+
+int main(int argc, char* argv[]) {
+    ios::sync_with_stdio(false);
+    if (argc < 2) {
+        print_usage(cerr);
+        return 2;
+    }
+    string command = argv[1];
+    if (command == "-h" || command == "--help") {
+        print_usage(cout);
+        return 0;
+    }
+
+    size_t threads = default_thread_count();
+    Options opts;
+    opts.verbose = false;
+    BenchConfig bench;
+    vector<string> paths;
+
+    try {
+        for (int i = 2; i < argc; ++i) {
+            string arg = argv[i];
+            auto value = [&]() -> string {
+                if (i + 1 >= argc) throw invalid_argument("Missing value for " + arg);
+                return argv[++i];
+            };
+            if (arg == "-t" || arg == "--threads")
+                threads = parse_number(value());
+            else if (arg == "-c" || arg == "--codec")
+                opts.codec = codec_by_name(value());
+            else if (arg == "-l" || arg == "--level")
+                opts.level = clamp(atoi(value().c_str()), LZ_MIN_LEVEL, LZ_MAX_LEVEL);
+            else if (arg == "-b" || arg == "--chunk-size")
+                opts.chunk_size = parse_size_list(value()).at(0);
+            else if (arg == "--split")
+                opts.split = parse_number(value());
+            else if (arg == "--in-flight")
+                opts.in_flight = parse_number(value());
+            else if (arg == "--mmap")
+                opts.use_mmap = true;
+            else if (arg == "-v" || arg == "--verbose")
+                opts.verbose = true;
+            else if (arg == "--bench-format")
+                bench.json = value() == "json";
+            else if (arg == "--bench-sizes")
+                bench.sizes = parse_size_list(value());
+            else if (arg == "--bench-threads")
+                bench.threads = parse_size_list(value());
+            else if (arg == "--bench-chunks")
+                bench.chunk_sizes = parse_size_list(value());
+            else if (arg == "--bench-repeats")
+                bench.repeats = parse_number(value());
+            else if (arg == "--bench-warmup")
+                bench.warmup = parse_number(value());
+            else if (arg.size() > 1 && arg[0] == '-')
+                throw invalid_argument("Unknown option: " + arg);
+            else
+                paths.push_back(arg);
+        }
+        if (threads == 0) threads = 1;
+        if (opts.in_flight == 0) opts.in_flight = 2 * threads;
+        if (opts.chunk_size > UINT32_MAX)
+            throw invalid_argument("Chunk size out of range.");
 
-        // Validate result
-        if (validate(input, decompressed))
-            cout << "Validation: Decompressed file matches original.\n";
-        else
-            cout << "Validation failed: Files differ!\n";
+        if (command == "bench") {
+            run_benchmark_suite(bench, opts, cout);
+            return 0;
+        }
 
-        // Benchmark performance
-        benchmark(input);
+        ThreadPool pool(threads);
+        if (command == "compress" || command == "decompress") {
+            if (paths.size() > 2) throw invalid_argument("Too many paths.");
+            string input = paths.empty() ? "-" : paths[0];
+            string output = paths.size() > 1 ? paths[1] : default_output(command, input);
+            if (command == "compress") compress(input, output, pool, opts);
+            else decompress(input, output, pool, opts);
+        } else if (command == "test") {
+            if (paths.empty()) paths.push_back("-");
+            bool ok = true;
+            for (const string& path : paths) ok &= verify(path, pool, opts);
+            return ok ? 0 : 1;
+        } else if (command == "extract") {
+            if (paths.size() < 3) throw invalid_argument("extract needs OFF LEN and an input file.");
+            ofstream out_file;
+            ostream& out = open_output(paths.size() > 3 ? paths[3] : "-", out_file);
+            extract_range(paths[2], parse_number(paths[0]), parse_number(paths[1]), out);
+        } else if (command == "archive") {
+            if (paths.empty() || paths.size() > 2) throw invalid_argument("archive needs DIR [out].");
+            string dir = paths[0];
+            while (dir.size() > 1 && dir.back() == '/') dir.pop_back();
+            archive(dir, paths.size() > 1 ? paths[1] : dir + ".rle", pool, opts);
+        } else if (command == "list") {
+            if (paths.size() != 1) throw invalid_argument("list needs ARCHIVE.");
+            list_archive(paths[0], cout);
+        } else if (command == "unpack") {
+            if (paths.empty() || paths.size() > 2) throw invalid_argument("unpack needs ARCHIVE [DIR].");
+            unpack_archive(paths[0], paths.size() > 1 ? paths[1] : ".", pool, opts);
+        } else if (command == "extract-file") {
+            if (paths.size() < 2 || paths.size() > 3)
+                throw invalid_argument("extract-file needs ARCHIVE PATH [out].");
+            extract_file(paths[0], paths[1], paths.size() > 2 ? paths[2] : "-", pool, opts);
+        } else if (command == "roundtrip") {
+            roundtrip(paths.empty() ? "input.txt" : paths[0], pool, opts);
+        } else {
+            print_usage(cerr);
+            return 2;
+        }
     } catch (const exception& e) {
         cerr << "Error: " << e.what() << "\n";
+        return 1;
     }
 
     return 0;
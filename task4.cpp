@@ -2,83 +2,732 @@
 #include <sstream>
 #include <string>
 #include <stdexcept>
-#include <cctype>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <climits>
+#include <cstdint>
+#include <new>
+#include <string_view>
+#include <unordered_map>
+#include <list>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <charconv>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TASK4_POSIX 1
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TASK4_X86 1
+#endif
+#if defined(__x86_64__) && defined(__linux__)
+#define TASK4_JIT 1
+#endif
 using namespace std;
 
 
 // Token types represent different components of the expression
 enum class TokenType {
-    NUMBER, PLUS, MINUS, MUL, DIV, LPAREN, RPAREN, END
+    NUMBER, IDENT, PLUS, MINUS, MUL, DIV, CARET, LPAREN, RPAREN, COMMA, QUESTION, COLON,
+    LT, LE, GT, GE, EQ, NE,  // from LT on, operators may take a trailing '='
+    END
 };
 
 // Token struct to store the token type and numeric value (if any)
 struct Token {
     TokenType type;
     double value; 
+    string_view name = {};  // IDENT only; points into the lexer's input
 };
 
-// Lexer: Responsible for converting the input string into a stream of tokens
+// Character classes for the lexer: one table lookup per character instead of
+// locale-dependent <cctype> calls
+enum CharClass : uint8_t {
+    CC_SPACE = 1,        // whitespace between tokens
+    CC_NUMBER = 2,       // digits and '.'
+    CC_IDENT_START = 4,  // letters and '_'
+    CC_IDENT = 8,        // letters, digits and '_'
+    CC_OPERATOR = 16,    // operator tokens, see CharTables::tokens
+};
+
+struct CharTables {
+    uint8_t classes[256] = {};
+    TokenType tokens[256] = {};
+};
+
+constexpr CharTables make_char_tables() {
+    CharTables t;
+    for (int c : {' ', '\t', '\n', '\v', '\f', '\r'}) t.classes[c] = CC_SPACE;
+    for (int c = '0'; c <= '9'; ++c) t.classes[c] = CC_NUMBER | CC_IDENT;
+    t.classes['.'] = CC_NUMBER;
+    for (int c = 'a'; c <= 'z'; ++c) t.classes[c] = CC_IDENT_START | CC_IDENT;
+    for (int c = 'A'; c <= 'Z'; ++c) t.classes[c] = CC_IDENT_START | CC_IDENT;
+    t.classes['_'] = CC_IDENT_START | CC_IDENT;
+    // '=' and '!' only start "==" and "!="; the lexer checks the second '='
+    const pair<char, TokenType> operators[] = {
+        {'+', TokenType::PLUS}, {'-', TokenType::MINUS}, {'*', TokenType::MUL},
+        {'/', TokenType::DIV}, {'^', TokenType::CARET}, {'(', TokenType::LPAREN},
+        {')', TokenType::RPAREN}, {',', TokenType::COMMA}, {'?', TokenType::QUESTION},
+        {':', TokenType::COLON}, {'<', TokenType::LT}, {'>', TokenType::GT},
+        {'=', TokenType::EQ}, {'!', TokenType::NE}};
+    for (const auto& op : operators) {
+        t.classes[(uint8_t)op.first] = CC_OPERATOR;
+        t.tokens[(uint8_t)op.first] = op.second;
+    }
+    return t;
+}
+
+constexpr CharTables CHAR_TABLES = make_char_tables();
+
+inline uint8_t char_class(char c) { return CHAR_TABLES.classes[(uint8_t)c]; }
+
+// Fast path for the common literal: at most 15 digits with at most 22 after
+// the point. Such a literal is an exact integer over an exact power of ten,
+// and one IEEE division rounds that correctly, so the result is the same
+// double from_chars would give (Clinger's fast path). On success advances
+// `p` past the literal; otherwise leaves it for from_chars.
+const double POWERS_OF_TEN[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+inline bool parse_short_number(const char*& p, const char* end, double& value) {
+    uint64_t mantissa = 0;
+    int digits = 0, fraction = -1;
+    const char* q = p;
+    for (; q < end; ++q) {
+        if (*q >= '0' && *q <= '9') {
+            mantissa = mantissa * 10 + (*q - '0');
+            digits++;
+            if (fraction >= 0) fraction++;
+        } else if (*q == '.' && fraction < 0) {
+            fraction = 0;
+        } else {
+            break;
+        }
+    }
+    if (digits == 0 || digits > 15 || fraction > 22 || (q < end && (char_class(*q) & CC_NUMBER)))
+        return false;
+    value = fraction > 0 ? (double)mantissa / POWERS_OF_TEN[fraction] : (double)mantissa;
+    p = q;
+    return true;
+}
+
+// Lexer: Responsible for converting the input string into a stream of tokens.
+// It only views the input, which must outlive it, and never allocates.
 class Lexer {
-    string input;      
-    size_t pos;       
-    char currentChar;  
+    string_view input;
+    size_t pos = 0;
 
 public:
-    // Constructor initializes input and sets the current character
-    Lexer(const string& text) : input(text), pos(0) {
-        currentChar = input[pos];
+    explicit Lexer(string_view text) : input(text) {}
+
+    // Returns the next token from the input string
+    Token getNextToken() {
+        const char* p = input.data() + pos;
+        const char* end = input.data() + input.size();
+        while (p < end && (char_class(*p) & CC_SPACE)) ++p;
+        if (p == end) {
+            pos = input.size();
+            return Token{TokenType::END, 0};
+        }
+
+        const char* start = p;
+        uint8_t cls = char_class(*p);
+        Token token{TokenType::END, 0};
+        if (cls & CC_NUMBER) {
+            // A multi-digit (and possibly floating-point) number, parsed in place
+            if (!parse_short_number(p, end, token.value)) {
+                while (p < end && (char_class(*p) & CC_NUMBER)) ++p;
+                auto [ptr, ec] = from_chars(start, p, token.value);
+                if (ec != errc() || ptr != p)
+                    throw runtime_error("Invalid number: " + string(start, p));
+            }
+            token.type = TokenType::NUMBER;
+        } else if (cls & CC_IDENT_START) {
+            // A letter or '_' followed by letters, digits or '_'
+            while (p < end && (char_class(*p) & CC_IDENT)) ++p;
+            token.type = TokenType::IDENT;
+            token.name = string_view(start, p - start);
+        } else if (cls & CC_OPERATOR) {
+            token.type = CHAR_TABLES.tokens[(uint8_t)*p++];
+            if (token.type >= TokenType::LT) {
+                bool has_equals = p < end && *p == '=';
+                if (token.type == TokenType::EQ || token.type == TokenType::NE) {
+                    if (!has_equals) throw runtime_error(string("Unknown character: ") + *start);
+                    ++p;
+                } else if (has_equals) {
+                    token.type = token.type == TokenType::LT ? TokenType::LE : TokenType::GE;
+                    ++p;
+                }
+            }
+        } else {
+            // If unknown character is encountered
+            throw runtime_error(string("Unknown character: ") + *p);
+        }
+        pos = p - input.data();
+        return token;
     }
+};
+
+// AST node kinds. NUMBER and VAR are leaves; NEG and the one-argument
+// functions (ABS .. EXP) have one child; SELECT (c ? a : b) has three; the
+// rest are binary. Comparisons give 1 or 0.
+enum class NodeType {
+    NUMBER, VAR, NEG, ADD, SUB, MUL, DIV,
+    POW, LT, LE, GT, GE, EQ, NE, MIN, MAX,
+    ABS, SQRT, LOG, EXP,
+    SELECT
+};
+
+inline bool is_unary(NodeType type) {
+    return type == NodeType::NEG || (type >= NodeType::ABS && type <= NodeType::EXP);
+}
+
+// AST node. Nodes are immutable once built and live in an Arena.
+struct Node {
+    NodeType type;
+    double value;        // NUMBER only
+    const Node* left;    // operand of unary nodes, left operand of binary nodes, SELECT's "then"
+    const Node* right;   // SELECT's "else"
+    uint32_t slot = 0;   // VAR only: index into the bound values
+    const Node* condition = nullptr;  // SELECT only
+};
+
+// Results of the operators that cannot fail. The tree walker, the optimizer,
+// the VM and batch evaluation all go through these, so they agree bit for
+// bit. min/max ignore a NaN operand, like fmin/fmax.
+inline double apply_unary(NodeType type, double x) {
+    switch (type) {
+    case NodeType::NEG: return -x;
+    case NodeType::ABS: return fabs(x);
+    case NodeType::SQRT: return sqrt(x);
+    case NodeType::LOG: return log(x);
+    case NodeType::EXP: return exp(x);
+    default: throw logic_error("Not a unary operator");
+    }
+}
+
+inline double apply_binary(NodeType type, double a, double b) {
+    switch (type) {
+    case NodeType::ADD: return a + b;
+    case NodeType::SUB: return a - b;
+    case NodeType::MUL: return a * b;
+    case NodeType::POW: return pow(a, b);
+    case NodeType::LT: return a < b ? 1.0 : 0.0;
+    case NodeType::LE: return a <= b ? 1.0 : 0.0;
+    case NodeType::GT: return a > b ? 1.0 : 0.0;
+    case NodeType::GE: return a >= b ? 1.0 : 0.0;
+    case NodeType::EQ: return a == b ? 1.0 : 0.0;
+    case NodeType::NE: return a != b ? 1.0 : 0.0;
+    // Not fmin/fmax: those leave the sign of min(-0, 0) open, and GCC treats
+    // them as commutative, so two call sites could disagree. A tie gives b.
+    case NodeType::MIN: return a < b || isnan(b) ? a : b;
+    case NodeType::MAX: return a > b || isnan(b) ? a : b;
+    default: throw logic_error("Not a total binary operator");
+    }
+}
+
+// Built-in functions. Names are looked up once while parsing; a call then
+// becomes an ordinary node, so evaluation never sees a name. min and max take
+// two or more arguments and nest left to right.
+struct Builtin {
+    const char* name;
+    NodeType type;
+    int min_args;
+    int max_args;
+};
+
+const Builtin BUILTINS[] = {
+    {"min", NodeType::MIN, 2, INT_MAX}, {"max", NodeType::MAX, 2, INT_MAX},
+    {"abs", NodeType::ABS, 1, 1},       {"sqrt", NodeType::SQRT, 1, 1},
+    {"log", NodeType::LOG, 1, 1},       {"exp", NodeType::EXP, 1, 1},
+};
 
-    // Moves to the next character in the input
-    void advance() {
-        pos++;
-        currentChar = (pos < input.size()) ? input[pos] : '\0';
+// Variable names of an expression. Each name gets a slot, its index here, at
+// compile time, so evaluation reads values[slot] and never compares strings.
+class SymbolTable {
+    vector<string> names;
+    unordered_map<string, uint32_t> slots;
+
+public:
+    static const uint32_t NOT_FOUND = UINT32_MAX;
+
+    // Returns the slot of `name`, assigning the next free one if it is new
+    uint32_t intern(string_view name) {
+        auto it = slots.find(string(name));
+        if (it != slots.end()) return it->second;
+        uint32_t slot = (uint32_t)names.size();
+        names.emplace_back(name);
+        slots.emplace(names.back(), slot);
+        return slot;
     }
 
-    // Skips whitespaces between tokens
-    void skipWhitespace() {
-        while (isspace(currentChar)) advance();
+    uint32_t find(const string& name) const {
+        auto it = slots.find(name);
+        return it == slots.end() ? NOT_FOUND : it->second;
     }
 
-    // Extracts a multi-digit (and possibly floating-point) number
-    double number() {
-        string numStr;
-        while (isdigit(currentChar) || currentChar == '.') {
-            numStr += currentChar;
-            advance();
+    size_t size() const { return names.size(); }
+    const string& name(uint32_t slot) const { return names[slot]; }
+};
+
+// Bump allocator for AST nodes: nodes of one expression sit next to each other
+// in a few large blocks and are all freed together with the arena.
+// Only trivially destructible objects may be allocated here.
+class Arena {
+    static const size_t BLOCK_SIZE = 16 << 10;
+    vector<unique_ptr<char[]>> blocks;
+    size_t first_block_size = 0;
+    char* next = nullptr;
+    size_t left = 0;
+
+public:
+    Arena() = default;
+    Arena(Arena&&) = default;
+    Arena& operator=(Arena&&) = default;
+
+    void* allocate(size_t size, size_t align) {
+        size_t pad = (align - reinterpret_cast<uintptr_t>(next) % align) % align;
+        if (pad + size > left) {
+            size_t block = max(size + align, (size_t)BLOCK_SIZE);
+            blocks.emplace_back(new char[block]);
+            if (blocks.size() == 1) first_block_size = block;
+            next = blocks.back().get();
+            left = block;
+            pad = (align - reinterpret_cast<uintptr_t>(next) % align) % align;
         }
-        return stod(numStr);  
+        void* p = next + pad;
+        next += pad + size;
+        left -= pad + size;
+        return p;
     }
 
-    // Returns the next token from the input string
-    Token getNextToken() {
-        skipWhitespace();
+    template <class T, class... Args>
+    T* make(Args&&... args) {
+        return new (allocate(sizeof(T), alignof(T))) T{std::forward<Args>(args)...};
+    }
+
+    // Drops every allocation but keeps the first block, so a reused arena
+    // stops calling the system allocator
+    void reset() {
+        if (blocks.empty()) return;
+        blocks.resize(1);
+        next = blocks[0].get();
+        left = first_block_size;
+    }
+};
+
+// Operators whose first operand is their `left` child: the chains a
+// left-associative parse builds (1+2+3+...) run down these
+inline bool on_left_spine(NodeType type) {
+    return type != NodeType::NUMBER && type != NodeType::VAR && type != NodeType::SELECT;
+}
 
-        if (isdigit(currentChar) || currentChar == '.') {
-            return Token{TokenType::NUMBER, number()};
+// Evaluates the subtree at `node`. The operators down its left spine are
+// stacked in `spine` and applied on the way back up, so a flat chain of any
+// length takes one native frame; only right operands and the parts of a
+// SELECT recurse. Entries past the size `spine` had on entry are this call's.
+double evaluate_spine(const Node* node, const double* values, vector<const Node*>& spine) {
+    size_t base = spine.size();
+    for (; on_left_spine(node->type); node = node->left) spine.push_back(node);
+    double result;
+    if (node->type == NodeType::NUMBER)
+        result = node->value;
+    else if (node->type == NodeType::VAR)
+        result = values[node->slot];
+    else
+        result = evaluate_spine(evaluate_spine(node->condition, values, spine) != 0 ? node->left : node->right,
+                                values, spine);
+    while (spine.size() > base) {
+        const Node* op = spine.back();
+        spine.pop_back();
+        switch (op->type) {
+        case NodeType::NEG: result = -result; break;
+        case NodeType::ADD: result += evaluate_spine(op->right, values, spine); break;
+        case NodeType::SUB: result -= evaluate_spine(op->right, values, spine); break;
+        case NodeType::MUL: result *= evaluate_spine(op->right, values, spine); break;
+        case NodeType::DIV: {
+            double denominator = evaluate_spine(op->right, values, spine);
+            if (denominator == 0)
+                throw runtime_error("Math error: Division by zero");
+            result /= denominator;
+            break;
         }
+        default:
+            if (is_unary(op->type)) result = apply_unary(op->type, result);
+            else result = apply_binary(op->type, result, evaluate_spine(op->right, values, spine));
+        }
+    }
+    return result;
+}
+
+// Evaluates a compiled tree; `values` holds one value per variable slot.
+// Only the chosen branch of a SELECT is evaluated.
+double evaluate(const Node* node, const double* values) {
+    thread_local vector<const Node*> spine;
+    spine.clear();  // a division by zero may have left entries behind
+    return evaluate_spine(node, values, spine);
+}
+
+// Optimization pass over a parsed tree. Every rewrite must give the same
+// bits as the original for every input, including -0, infinities and NaN, so
+// only exact rules apply:
+//  - operators whose operands are all constants are folded, except a
+//    division by a constant zero, which must still fail at evaluation time;
+//  - x*1, 1*x, x/1, x-0, x+(-0), (-0)+x and --x become x. x+0 stays,
+//    since it turns -0 into +0;
+//  - x/c becomes x*(1/c) when c is a power of two whose reciprocal is a
+//    normal double, because then both round the same exact value.
+// A SELECT with a constant condition becomes the chosen branch. Operands are
+// never reordered or reassociated, so (60*60*24)*x folds but x*60*60 does
+// not. (Signaling NaN inputs are the one exception: the arithmetic a rewrite
+// removes would have quieted them.)
+bool is_constant(const Node* node, double value) {
+    return node->type == NodeType::NUMBER && memcmp(&node->value, &value, sizeof value) == 0;
+}
+
+bool has_exact_reciprocal(double c) {
+    int exponent;
+    double mantissa = frexp(c, &exponent);
+    return (mantissa == 0.5 || mantissa == -0.5) && isnormal(c) && isnormal(1 / c);
+}
+
+const Node* constant_node(double value, Arena& arena) {
+    return arena.make<Node>(NodeType::NUMBER, value, nullptr, nullptr);
+}
 
-        if (currentChar == '+') { advance(); return Token{TokenType::PLUS, 0}; }
-        if (currentChar == '-') { advance(); return Token{TokenType::MINUS, 0}; }
-        if (currentChar == '*') { advance(); return Token{TokenType::MUL, 0}; }
-        if (currentChar == '/') { advance(); return Token{TokenType::DIV, 0}; }
-        if (currentChar == '(') { advance(); return Token{TokenType::LPAREN, 0}; }
-        if (currentChar == ')') { advance(); return Token{TokenType::RPAREN, 0}; }
+// The rules for a unary node whose operand is already optimized
+const Node* optimize_unary(const Node* node, const Node* operand, Arena& arena) {
+    if (operand->type == NodeType::NUMBER) return constant_node(apply_unary(node->type, operand->value), arena);
+    if (node->type == NodeType::NEG && operand->type == NodeType::NEG) return operand->left;
+    return operand == node->left ? node : arena.make<Node>(node->type, 0.0, operand, nullptr);
+}
 
-        if (currentChar == '\0') return Token{TokenType::END, 0};
+// The rules for a binary node whose operands are already optimized
+const Node* optimize_binary(const Node* node, const Node* left, const Node* right, Arena& arena) {
+    if (left->type == NodeType::NUMBER && right->type == NodeType::NUMBER) {
+        double a = left->value, b = right->value;
+        if (node->type != NodeType::DIV) return constant_node(apply_binary(node->type, a, b), arena);
+        if (b != 0) return constant_node(a / b, arena);
+    }
+    switch (node->type) {
+    case NodeType::ADD:
+        if (is_constant(right, -0.0)) return left;
+        if (is_constant(left, -0.0)) return right;
+        break;
+    case NodeType::SUB:
+        if (is_constant(right, 0.0)) return left;
+        break;
+    case NodeType::MUL:
+        if (is_constant(right, 1.0)) return left;
+        if (is_constant(left, 1.0)) return right;
+        break;
+    case NodeType::DIV:
+        if (is_constant(right, 1.0)) return left;
+        if (right->type == NodeType::NUMBER && has_exact_reciprocal(right->value))
+            return arena.make<Node>(NodeType::MUL, 0.0, left, constant_node(1 / right->value, arena));
+        break;
+    default:
+        break;
+    }
+    if (left == node->left && right == node->right) return node;
+    return arena.make<Node>(node->type, 0.0, left, right);
+}
 
-        // If unknown character is encountered
-        throw runtime_error(string("Unknown character: ") + currentChar);
+// Optimizes the subtree at `node`, walking its left spine in a loop like
+// evaluate_spine() does
+const Node* optimize_spine(const Node* node, Arena& arena, vector<const Node*>& spine) {
+    size_t base = spine.size();
+    for (; on_left_spine(node->type); node = node->left) spine.push_back(node);
+    const Node* result = node;
+    if (node->type == NodeType::SELECT) {
+        const Node* condition = optimize_spine(node->condition, arena, spine);
+        if (condition->type == NodeType::NUMBER) {
+            result = optimize_spine(condition->value != 0 ? node->left : node->right, arena, spine);
+        } else {
+            const Node* then = optimize_spine(node->left, arena, spine);
+            const Node* otherwise = optimize_spine(node->right, arena, spine);
+            result = arena.make<Node>(NodeType::SELECT, 0.0, then, otherwise, 0u, condition);
+        }
+    }
+    while (spine.size() > base) {
+        const Node* op = spine.back();
+        spine.pop_back();
+        if (is_unary(op->type)) result = optimize_unary(op, result, arena);
+        else result = optimize_binary(op, result, optimize_spine(op->right, arena, spine), arena);
     }
+    return result;
+}
+
+const Node* optimize(const Node* node, Arena& arena) {
+    vector<const Node*> spine;
+    return optimize_spine(node, arena, spine);
+}
+
+// Binding power of an infix operator (0: not infix); higher binds tighter.
+// Unary minus sits between * and ^, so -x^2 is -(x^2) and -a*b is (-a)*b.
+struct InfixOperator {
+    int power;
+    bool right_assoc;
+    NodeType type;
+};
+
+const int PREFIX_POWER = 6;
+
+// Indexed by TokenType
+const InfixOperator INFIX_OPERATORS[] = {
+    {0, false, NodeType::NUMBER}, {0, false, NodeType::NUMBER},              // NUMBER, IDENT
+    {4, false, NodeType::ADD},    {4, false, NodeType::SUB},                 // + -
+    {5, false, NodeType::MUL},    {5, false, NodeType::DIV},                 // * /
+    {7, true, NodeType::POW},                                                // ^
+    {0, false, NodeType::NUMBER}, {0, false, NodeType::NUMBER},              // ( )
+    {0, false, NodeType::NUMBER}, {1, true, NodeType::SELECT},               // , ?
+    {0, false, NodeType::NUMBER},                                            // :
+    {3, false, NodeType::LT},     {3, false, NodeType::LE},                  // < <=
+    {3, false, NodeType::GT},     {3, false, NodeType::GE},                  // > >=
+    {2, false, NodeType::EQ},     {2, false, NodeType::NE},                  // == !=
+    {0, false, NodeType::NUMBER},                                            // END
+};
+
+static_assert(size(INFIX_OPERATORS) == (size_t)TokenType::END + 1, "one row per token type");
+
+inline const InfixOperator& infix_operator(TokenType type) { return INFIX_OPERATORS[(size_t)type]; }
+
+// Limits on what the parser accepts. Parsing keeps its own stacks, so any
+// nesting fits. optimize(), evaluate() and Bytecode::emit() walk left spines
+// in a loop, so flat chains like 1+1+...+1 cost them nothing, but they
+// recurse once per level of real nesting: right operands (a^b^c or
+// a-(b-c)), function arguments after the first and the parts of a ?:.
+// Trees nested deeper than max_depth are refused so that they stay well
+// inside a thread's native stack. max_nodes bounds the memory of one
+// expression. Parentheses, unary operators and double negations add no
+// levels.
+struct ParseLimits {
+    size_t max_depth = 10000;
+    size_t max_nodes = size_t(1) << 24;
 };
 
-// Parser: Implements recursive descent parsing and evaluates the expression
+// Limits used when a parser is given none; main() sets them from the
+// command line before any parsing starts
+ParseLimits parse_limits;
+
+// Parser: precedence climbing (Pratt) over the token stream, building an AST
+// in an arena. One loop handles every infix level, so a new operator is a
+// new row in INFIX_OPERATORS rather than another level of recursion.
+// Operators and brackets still waiting for operands live, with the operands
+// they already have, on an explicit frame stack, so the native stack use is
+// the same for "1" and for 100000 nested parentheses.
 class Parser {
+    // A finished subtree and its nesting depth, the native frames the tree
+    // walkers need for it: 1 for a leaf, a left operand's depth, one more
+    // than a right operand's, and one more than the deepest part of a ?:
+    struct Operand {
+        const Node* node;
+        size_t depth;
+    };
+    // Frames before PAREN are operators, reduced once the next token binds no
+    // tighter than min_power. Brackets have min_power -1 and wait for their
+    // closing token instead; BOTTOM lies under every parse.
+    enum class FrameKind : uint8_t { NEG, INFIX, ELSE, PAREN, CALL, THEN, BOTTOM };
+    struct Frame {
+        FrameKind kind;
+        int8_t min_power;
+        uint8_t builtin;    // CALL: index into BUILTINS
+        NodeType type;      // INFIX: the operator
+        uint32_t args;      // CALL: arguments read so far
+        Operand left;       // INFIX: left operand; THEN, ELSE: the condition
+    };
+
     Lexer lexer;        
     Token currentToken; 
+    ParseLimits limits;
+    Arena* arena = nullptr;
+    SymbolTable* symbols = nullptr;
+    size_t nodes = 0;
+    // Per-thread stacks, reused so that short formulas parse without
+    // allocating. The operand being built is kept out of them; `operands`
+    // only holds call arguments and the then-branches of open ternaries.
+    struct Stacks {
+        vector<Frame> frames;
+        vector<Operand> operands;
+    };
+    static Stacks& thread_stacks() {
+        thread_local Stacks stacks;
+        return stacks;
+    }
+    Stacks& stacks = thread_stacks();
+    vector<Operand>& operands = stacks.operands;
+    // stacks.frames is only storage: `top` points at the innermost open
+    // frame. Every token pushes or pops a frame, and bare pointer steps
+    // cost no more than the calls and returns of a recursive parser.
+    Frame* top = nullptr;
+    Frame* frames_end = nullptr;
+
+    // Doubles the frame storage once a push has reached its end
+    void grow() {
+        vector<Frame>& frames = stacks.frames;
+        size_t used = top - frames.data();
+        frames.resize(max<size_t>(64, frames.size() * 2));
+        top = frames.data() + used;
+        frames_end = frames.data() + frames.size();
+    }
+
+    // A new node of the given depth, within the limits
+    Operand make(NodeType type, size_t depth, double value, const Node* left = nullptr,
+                 const Node* right = nullptr, uint32_t slot = 0, const Node* condition = nullptr) {
+        if (depth > limits.max_depth || ++nodes > limits.max_nodes) over_limit(depth);
+        return {arena->make<Node>(type, value, left, right, slot, condition), depth};
+    }
+
+    [[noreturn]] void over_limit(size_t depth) const {
+        if (depth > limits.max_depth)
+            throw runtime_error("Expression nested deeper than " + to_string(limits.max_depth) + " levels");
+        throw runtime_error("Expression larger than " + to_string(limits.max_nodes) + " nodes");
+    }
+
+    void open(FrameKind kind, int min_power, NodeType type = NodeType::NUMBER, Operand left = {nullptr, 0},
+              uint8_t builtin = 0) {
+        if (++top == frames_end) grow();
+        *top = {kind, (int8_t)min_power, builtin, type, 0, left};
+    }
+
+    // Applies the operator frame on top, which is popped, to `right`
+    Operand reduce(Operand right) {
+        Frame frame = *top--;
+        if (frame.kind == FrameKind::INFIX)
+            return make(frame.type, max(frame.left.depth, right.depth + 1), 0.0, frame.left.node, right.node);
+        if (frame.kind == FrameKind::NEG) {
+            // --x is x bit for bit, so ----...1 stays one node
+            if (right.node->type == NodeType::NEG) return {right.node->left, right.depth};
+            return make(NodeType::NEG, right.depth, 0.0, right.node);
+        }
+        Operand then = operands.back();
+        operands.pop_back();
+        return make(NodeType::SELECT, max({frame.left.depth, then.depth, right.depth}) + 1, 0.0,
+                    then.node, right.node, 0u, frame.left.node);
+    }
+
+    // Replaces the arguments of a finished call, popped from `operands`,
+    // with its node; min and max nest left to right
+    Operand call(const Frame& frame) {
+        const Builtin& builtin = BUILTINS[frame.builtin];
+        if ((int)frame.args < builtin.min_args || (int)frame.args > builtin.max_args)
+            throw runtime_error("Wrong number of arguments to " + string(builtin.name));
+        size_t first = operands.size() - frame.args;
+        Operand result = operands[first];
+        if (frame.args == 1) result = make(builtin.type, result.depth, 0.0, result.node);
+        for (size_t i = first + 1; i < operands.size(); ++i) {
+            const Operand& next = operands[i];
+            result = make(builtin.type, max(result.depth, next.depth + 1), 0.0, result.node, next.node);
+        }
+        operands.resize(first);
+        return result;
+    }
+
+    static uint8_t builtin(string_view name) {
+        for (size_t i = 0; i < size(BUILTINS); ++i)
+            if (name == BUILTINS[i].name) return (uint8_t)i;
+        throw runtime_error("Unknown function: " + string(name));
+    }
+
+    // Reads an operand: opens a frame for each prefix minus, '(' and call,
+    // then returns the number or variable they wrap
+    Operand operand() {
+        for (;;) {
+            switch (currentToken.type) {
+            case TokenType::MINUS:
+                eat(TokenType::MINUS);
+                open(FrameKind::NEG, PREFIX_POWER);
+                break;
+            case TokenType::LPAREN:
+                eat(TokenType::LPAREN);
+                open(FrameKind::PAREN, -1);
+                break;
+            case TokenType::NUMBER: {
+                double val = currentToken.value;
+                eat(TokenType::NUMBER);
+                return make(NodeType::NUMBER, 1, val);
+            }
+            case TokenType::IDENT: {
+                string_view name = currentToken.name;
+                eat(TokenType::IDENT);
+                if (currentToken.type == TokenType::LPAREN) {
+                    open(FrameKind::CALL, -1, NodeType::NUMBER, {nullptr, 0}, builtin(name));
+                    eat(TokenType::LPAREN);
+                    break;
+                }
+                return make(NodeType::VAR, 1, 0.0, nullptr, nullptr, symbols->intern(name));
+            }
+            default:
+                throw runtime_error("Syntax error: Unexpected token in factor");
+            }
+        }
+    }
+
+    // Reads what follows the operand `current`: reduces the operators the
+    // next token ends and closes brackets. Returns true once an infix
+    // operator, ',' or ':' asks for another operand, and false at the end of
+    // the input, leaving the whole expression in `current`.
+    bool operators(Operand& current) {
+        for (;;) {
+            const InfixOperator& op = infix_operator(currentToken.type);
+            while (op.power <= top->min_power) current = reduce(current);
+            if (op.power > 0) {
+                eat(currentToken.type);
+                if (op.type == NodeType::SELECT)
+                    open(FrameKind::THEN, -1, NodeType::SELECT, current);
+                else
+                    open(FrameKind::INFIX, op.right_assoc ? op.power - 1 : op.power, op.type, current);
+                return true;
+            }
+            Frame& frame = *top;
+            switch (frame.kind) {
+            case FrameKind::BOTTOM:
+                if (currentToken.type != TokenType::END)
+                    throw runtime_error("Syntax error: Unexpected input after expression");
+                return false;
+            case FrameKind::THEN:
+                if (currentToken.type != TokenType::COLON)
+                    throw runtime_error("Syntax error: Expected ':'");
+                eat(TokenType::COLON);
+                operands.push_back(current);
+                frame.kind = FrameKind::ELSE;
+                frame.min_power = 0;
+                return true;
+            case FrameKind::CALL:
+                frame.args++;
+                operands.push_back(current);
+                if (currentToken.type == TokenType::COMMA) {
+                    eat(TokenType::COMMA);
+                    return true;
+                }
+                [[fallthrough]];
+            default:
+                if (currentToken.type != TokenType::RPAREN)
+                    throw runtime_error("Syntax error: Expected ')'");
+                eat(TokenType::RPAREN);
+                if (frame.kind == FrameKind::CALL) current = call(frame);
+                --top;
+            }
+        }
+    }
 
 public: 
-    Parser(const string& text) : lexer(text) {
+    Parser(string_view text, const ParseLimits& limits = parse_limits)
+        : lexer(text), limits(limits) {
         currentToken = lexer.getNextToken();
     }
 
@@ -90,83 +739,1406 @@ public:
             throw runtime_error("Syntax error: Unexpected token");
     }
 
-    // Parses and returns a factor
-    double factor() {
-        if (currentToken.type == TokenType::NUMBER) {
-            double val = currentToken.value;
-            eat(TokenType::NUMBER);
-            return val;
-        } else if (currentToken.type == TokenType::LPAREN) {
-            eat(TokenType::LPAREN);
-            double result = expr();  
-            if (currentToken.type != TokenType::RPAREN)
-                throw runtime_error("Syntax error: Expected ')'");
-            eat(TokenType::RPAREN);
-            return result;
-        } else if (currentToken.type == TokenType::MINUS) {
-            eat(TokenType::MINUS);
-            return -factor();
-        }
-        throw runtime_error("Syntax error: Unexpected token in factor");
-    }
-
-    // Parses and returns a term
-    double term() {
-        double result = factor();
-
-        while (currentToken.type == TokenType::MUL || currentToken.type == TokenType::DIV) {
-            Token token = currentToken;
-            if (token.type == TokenType::MUL) {
-                eat(TokenType::MUL);
-                result *= factor();
-            } else if (token.type == TokenType::DIV) {
-                eat(TokenType::DIV);
-                double denominator = factor();
-                if (denominator == 0)
-                    throw runtime_error("Math error: Division by zero");
-                result /= denominator;
+    // Parses the whole input into `target` and returns the root node;
+    // variables are given slots in `table`
+    const Node* compile(Arena& target, SymbolTable& table) {
+        arena = &target;
+        symbols = &table;
+        nodes = 0;
+        vector<Frame>& frames = stacks.frames;
+        if (frames.empty()) frames.resize(64);
+        top = frames.data();
+        frames_end = frames.data() + frames.size();
+        *top = {FrameKind::BOTTOM, -1, 0, NodeType::NUMBER, 0, {nullptr, 0}};
+        operands.clear();
+        Operand current;
+        do current = operand();
+        while (operators(current));
+        return current.node;
+    }
+
+    // Begins the parsing process and returns the final result; the input
+    // must not contain variables
+    double parse() {
+        thread_local Arena scratch;
+        scratch.reset();
+        SymbolTable table;
+        const Node* root = compile(scratch, table);
+        if (table.size() > 0)
+            throw runtime_error("Unbound variable: " + table.name(0));
+        return evaluate(root, nullptr);
+    }
+};
+
+// Stack-machine instruction set. Operands are popped right-first and the
+// result is pushed; RET pops the final value. Opcodes added after RET keep
+// the numbering of version 1 files valid.
+enum class OpCode : uint8_t {
+    PUSH_CONST,  // push constants[arg]
+    LOAD_VAR,    // push values[arg]
+    NEG, ADD, SUB, MUL, DIV,
+    RET,
+    POW, LT, LE, GT, GE, EQ, NE, MIN, MAX,
+    ABS, SQRT, LOG, EXP,
+    JUMP_IF_FALSE,  // pop; if it was 0, continue at instruction arg
+    JUMP            // continue at instruction arg
+};
+
+const size_t OPCODE_COUNT = (size_t)OpCode::JUMP + 1;
+
+struct Instruction {
+    OpCode op;
+    uint32_t arg;  // constant index, variable slot or jump target; unused otherwise
+};
+
+// Node type computed by each opcode, for the opcodes backed by apply_unary
+// and apply_binary; NUMBER marks the others
+const NodeType OPCODE_NODE_TYPES[OPCODE_COUNT] = {
+    NodeType::NUMBER, NodeType::NUMBER, NodeType::NEG, NodeType::ADD, NodeType::SUB,
+    NodeType::MUL, NodeType::NUMBER, NodeType::NUMBER,
+    NodeType::POW, NodeType::LT, NodeType::LE, NodeType::GT, NodeType::GE, NodeType::EQ,
+    NodeType::NE, NodeType::MIN, NodeType::MAX,
+    NodeType::ABS, NodeType::SQRT, NodeType::LOG, NodeType::EXP,
+    NodeType::NUMBER, NodeType::NUMBER};
+
+inline OpCode opcode_for(NodeType type) {
+    if (type == NodeType::DIV) return OpCode::DIV;
+    for (size_t op = 0; op < OPCODE_COUNT; ++op)
+        if (OPCODE_NODE_TYPES[op] == type) return (OpCode)op;
+    throw logic_error("No opcode for node type");
+}
+
+// Compiled form of an expression: a flat instruction list, its constant
+// pool and the variable names by slot. It can be written to disk and loaded
+// back without the source text.
+class Bytecode {
+    vector<Instruction> code;
+    vector<double> constants;
+    vector<string> names;
+    uint32_t max_stack = 0;
+
+    // Emits the subtree at `node` for a stack `depth` deep; the operators
+    // down its left spine are walked in a loop, as in evaluate_spine()
+    void emit(const Node* node, uint32_t depth, vector<const Node*>& spine) {
+        size_t base = spine.size();
+        for (; on_left_spine(node->type); node = node->left) spine.push_back(node);
+        switch (node->type) {
+        case NodeType::NUMBER:
+            code.push_back({OpCode::PUSH_CONST, (uint32_t)constants.size()});
+            constants.push_back(node->value);
+            max_stack = max(max_stack, depth + 1);
+            break;
+        case NodeType::VAR:
+            code.push_back({OpCode::LOAD_VAR, node->slot});
+            max_stack = max(max_stack, depth + 1);
+            break;
+        default: {
+            // condition; JUMP_IF_FALSE else; then; JUMP end; else: ...; end:
+            emit(node->condition, depth, spine);
+            size_t to_else = code.size();
+            code.push_back({OpCode::JUMP_IF_FALSE, 0});
+            emit(node->left, depth, spine);
+            size_t to_end = code.size();
+            code.push_back({OpCode::JUMP, 0});
+            code[to_else].arg = (uint32_t)code.size();
+            emit(node->right, depth, spine);
+            code[to_end].arg = (uint32_t)code.size();
+            break;
+        }
+        }
+        while (spine.size() > base) {
+            const Node* op = spine.back();
+            spine.pop_back();
+            if (!is_unary(op->type)) emit(op->right, depth + 1, spine);
+            code.push_back({opcode_for(op->type), 0});
+        }
+    }
+
+    // Checks that every operand index is in range, jumps only go forward to
+    // an instruction reached with the same stack depth, and the stack never
+    // underflows; recomputes max_stack. run() relies on all of these.
+    void validate() {
+        vector<int64_t> depth_at(code.size(), -1);  // depth promised by a jump
+        int64_t depth = 0;
+        bool reachable = true;
+        max_stack = 0;
+        for (size_t i = 0; i < code.size(); ++i) {
+            const Instruction& in = code[i];
+            if (depth_at[i] >= 0) {
+                if (reachable && depth != depth_at[i]) throw runtime_error("Bytecode: stack mismatch at jump target");
+                depth = depth_at[i];
+                reachable = true;
             }
+            if (!reachable) throw runtime_error("Bytecode: unreachable code");
+            if ((size_t)in.op >= OPCODE_COUNT) throw runtime_error("Bytecode: unknown opcode");
+            NodeType type = OPCODE_NODE_TYPES[(size_t)in.op];
+            int pops = 2, pushes = 1;
+            switch (in.op) {
+            case OpCode::PUSH_CONST:
+                if (in.arg >= constants.size()) throw runtime_error("Bytecode: bad constant index");
+                pops = 0;
+                break;
+            case OpCode::LOAD_VAR:
+                if (in.arg >= names.size()) throw runtime_error("Bytecode: bad variable slot");
+                pops = 0;
+                break;
+            case OpCode::RET:
+                if (depth != 1 || i + 1 != code.size()) throw runtime_error("Bytecode: bad return");
+                return;
+            case OpCode::JUMP_IF_FALSE:
+            case OpCode::JUMP:
+                pops = in.op == OpCode::JUMP ? 0 : 1;
+                pushes = 0;
+                if (in.arg <= i || in.arg >= code.size()) throw runtime_error("Bytecode: bad jump target");
+                if (depth < pops) throw runtime_error("Bytecode: stack underflow");
+                if (depth_at[in.arg] >= 0 && depth_at[in.arg] != depth - pops)
+                    throw runtime_error("Bytecode: stack mismatch at jump target");
+                depth_at[in.arg] = depth - pops;
+                break;
+            default:
+                if (is_unary(type)) pops = 1;
+                break;
+            }
+            if (depth < pops) throw runtime_error("Bytecode: stack underflow");
+            depth += pushes - pops;
+            if (in.op == OpCode::JUMP) reachable = false;
+            max_stack = max<uint32_t>(max_stack, (uint32_t)depth);
         }
+        throw runtime_error("Bytecode: missing return");
+    }
 
-        return result;
+public:
+    Bytecode() = default;
+
+    Bytecode(const Node* root, const SymbolTable& symbols) {
+        vector<const Node*> spine;
+        emit(root, 0, spine);
+        code.push_back({OpCode::RET, 0});
+        for (uint32_t slot = 0; slot < symbols.size(); ++slot) names.push_back(symbols.name(slot));
     }
 
-    // Parses and returns an expression
-    double expr() {
-        double result = term();
+    const vector<string>& variables() const { return names; }
+    const vector<Instruction>& instructions() const { return code; }
+    const vector<double>& constant_pool() const { return constants; }
+    size_t stack_size() const { return max_stack; }
 
-        while (currentToken.type == TokenType::PLUS || currentToken.type == TokenType::MINUS) {
-            Token token = currentToken;
-            if (token.type == TokenType::PLUS) {
-                eat(TokenType::PLUS);
-                result += term();
-            } else if (token.type == TokenType::MINUS) {
-                eat(TokenType::MINUS);
-                result -= term();
+    // Division by zero throws, or, when `div_zero` is given, yields NaN and
+    // sets *div_zero as run_batch does
+    double run(const double* values, bool* div_zero = nullptr) const;
+    // `kernels` defaults to the best set for this CPU (batch_kernels)
+    void run_batch(const double* const* columns, size_t rows, double* out, uint8_t* div_zero,
+                   const struct BatchKernels* kernels = nullptr) const;
+
+    void save(ostream& out) const;
+    static Bytecode load(istream& in);
+};
+
+// The VM loop. With GCC/Clang each handler jumps straight to the next one
+// through a label table (computed goto); other compilers use a switch.
+double Bytecode::run(const double* values, bool* div_zero) const {
+    double small[32];
+    vector<double> large;
+    double* stack = small;
+    if (max_stack > 32) {
+        large.resize(max_stack);
+        stack = large.data();
+    }
+    double* sp = stack;  // points one past the top
+    const Instruction* ip = code.data();
+    const double* pool = constants.data();
+
+#if defined(__GNUC__)
+    static void* const labels[OPCODE_COUNT] = {
+        &&op_push_const, &&op_load_var, &&op_neg, &&op_add, &&op_sub, &&op_mul, &&op_div,
+        &&op_ret, &&op_pow, &&op_lt, &&op_le, &&op_gt, &&op_ge, &&op_eq, &&op_ne, &&op_min,
+        &&op_max, &&op_abs, &&op_sqrt, &&op_log, &&op_exp, &&op_jump_if_false, &&op_jump};
+#define DISPATCH() goto *labels[(size_t)ip->op]
+#define CASE(name) op_##name
+#define NEXT() ++ip; DISPATCH()
+#define JUMP_TO(target) ip = code.data() + (target); DISPATCH()
+    DISPATCH();
+#else
+#define CASE(name) case_##name
+#define NEXT() ++ip; continue
+#define JUMP_TO(target) ip = code.data() + (target); continue
+    for (;;) {
+        switch (ip->op) {
+        case OpCode::PUSH_CONST: goto CASE(push_const);
+        case OpCode::LOAD_VAR: goto CASE(load_var);
+        case OpCode::NEG: goto CASE(neg);
+        case OpCode::ADD: goto CASE(add);
+        case OpCode::SUB: goto CASE(sub);
+        case OpCode::MUL: goto CASE(mul);
+        case OpCode::DIV: goto CASE(div);
+        case OpCode::RET: goto CASE(ret);
+        case OpCode::POW: goto CASE(pow);
+        case OpCode::LT: goto CASE(lt);
+        case OpCode::LE: goto CASE(le);
+        case OpCode::GT: goto CASE(gt);
+        case OpCode::GE: goto CASE(ge);
+        case OpCode::EQ: goto CASE(eq);
+        case OpCode::NE: goto CASE(ne);
+        case OpCode::MIN: goto CASE(min);
+        case OpCode::MAX: goto CASE(max);
+        case OpCode::ABS: goto CASE(abs);
+        case OpCode::SQRT: goto CASE(sqrt);
+        case OpCode::LOG: goto CASE(log);
+        case OpCode::EXP: goto CASE(exp);
+        case OpCode::JUMP_IF_FALSE: goto CASE(jump_if_false);
+        case OpCode::JUMP: goto CASE(jump);
+        }
+#endif
+    CASE(push_const):
+        *sp++ = pool[ip->arg];
+        NEXT();
+    CASE(load_var):
+        *sp++ = values[ip->arg];
+        NEXT();
+    CASE(neg):
+        sp[-1] = -sp[-1];
+        NEXT();
+    CASE(add):
+        --sp;
+        sp[-1] += sp[0];
+        NEXT();
+    CASE(sub):
+        --sp;
+        sp[-1] -= sp[0];
+        NEXT();
+    CASE(mul):
+        --sp;
+        sp[-1] *= sp[0];
+        NEXT();
+    CASE(div):
+        --sp;
+        if (sp[0] == 0) {
+            if (!div_zero) throw runtime_error("Math error: Division by zero");
+            *div_zero = true;
+            sp[-1] = numeric_limits<double>::quiet_NaN();
+            NEXT();
+        }
+        sp[-1] /= sp[0];
+        NEXT();
+    CASE(jump_if_false):
+        --sp;
+        if (sp[0] == 0) {
+            JUMP_TO(ip->arg);
+        }
+        NEXT();
+    CASE(jump):
+        JUMP_TO(ip->arg);
+#define BINARY_CASE(name, type)                        \
+    CASE(name):                                       \
+        --sp;                                         \
+        sp[-1] = apply_binary(NodeType::type, sp[-1], sp[0]); \
+        NEXT();
+#define UNARY_CASE(name, type)                         \
+    CASE(name):                                       \
+        sp[-1] = apply_unary(NodeType::type, sp[-1]);  \
+        NEXT();
+    BINARY_CASE(pow, POW)
+    BINARY_CASE(lt, LT)
+    BINARY_CASE(le, LE)
+    BINARY_CASE(gt, GT)
+    BINARY_CASE(ge, GE)
+    BINARY_CASE(eq, EQ)
+    BINARY_CASE(ne, NE)
+    BINARY_CASE(min, MIN)
+    BINARY_CASE(max, MAX)
+    UNARY_CASE(abs, ABS)
+    UNARY_CASE(sqrt, SQRT)
+    UNARY_CASE(log, LOG)
+    UNARY_CASE(exp, EXP)
+    CASE(ret):
+        return sp[-1];
+#if !defined(__GNUC__)
+    }
+#endif
+#undef BINARY_CASE
+#undef UNARY_CASE
+#undef DISPATCH
+#undef CASE
+#undef NEXT
+#undef JUMP_TO
+}
+
+// Column kernels for batch evaluation: each applies one operator to a block
+// of rows in place, `a[i] = a[i] op b[i]`. Division by zero yields NaN for
+// that row and sets div_zero[i] instead of throwing.
+struct BatchKernels {
+    const char* name;
+    void (*neg)(double* a, size_t n);
+    void (*add)(double* a, const double* b, size_t n);
+    void (*sub)(double* a, const double* b, size_t n);
+    void (*mul)(double* a, const double* b, size_t n);
+    void (*div)(double* a, const double* b, size_t n, uint8_t* div_zero);
+};
+
+void neg_scalar(double* a, size_t n) { for (size_t i = 0; i < n; ++i) a[i] = -a[i]; }
+void add_scalar(double* a, const double* b, size_t n) { for (size_t i = 0; i < n; ++i) a[i] += b[i]; }
+void sub_scalar(double* a, const double* b, size_t n) { for (size_t i = 0; i < n; ++i) a[i] -= b[i]; }
+void mul_scalar(double* a, const double* b, size_t n) { for (size_t i = 0; i < n; ++i) a[i] *= b[i]; }
+
+void div_scalar(double* a, const double* b, size_t n, uint8_t* div_zero) {
+    for (size_t i = 0; i < n; ++i) {
+        if (b[i] == 0) {
+            a[i] = numeric_limits<double>::quiet_NaN();
+            div_zero[i] = 1;
+        } else {
+            a[i] /= b[i];
+        }
+    }
+}
+
+const BatchKernels SCALAR_KERNELS = {"scalar", neg_scalar, add_scalar, sub_scalar, mul_scalar, div_scalar};
+
+#ifdef TASK4_X86
+// Four rows per instruction; the loop tails fall back to the scalar kernels
+#define TASK4_AVX2_BINARY(op, intrinsic)                                          \
+    __attribute__((target("avx2"))) void op##_avx2(double* a, const double* b, size_t n) { \
+        size_t i = 0;                                                           \
+        for (; i + 4 <= n; i += 4)                                              \
+            _mm256_storeu_pd(a + i, intrinsic(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i))); \
+        op##_scalar(a + i, b + i, n - i);                                       \
+    }
+TASK4_AVX2_BINARY(add, _mm256_add_pd)
+TASK4_AVX2_BINARY(sub, _mm256_sub_pd)
+TASK4_AVX2_BINARY(mul, _mm256_mul_pd)
+#undef TASK4_AVX2_BINARY
+
+__attribute__((target("avx2"))) void neg_avx2(double* a, size_t n) {
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) _mm256_storeu_pd(a + i, _mm256_xor_pd(_mm256_loadu_pd(a + i), sign));
+    neg_scalar(a + i, n - i);
+}
+
+__attribute__((target("avx2"))) void div_avx2(double* a, const double* b, size_t n, uint8_t* div_zero) {
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d nan = _mm256_set1_pd(numeric_limits<double>::quiet_NaN());
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d den = _mm256_loadu_pd(b + i);
+        __m256d is_zero = _mm256_cmp_pd(den, zero, _CMP_EQ_OQ);
+        __m256d q = _mm256_div_pd(_mm256_loadu_pd(a + i), den);
+        _mm256_storeu_pd(a + i, _mm256_blendv_pd(q, nan, is_zero));
+        int lanes = _mm256_movemask_pd(is_zero);
+        if (lanes) {
+            for (int k = 0; k < 4; ++k)
+                if (lanes >> k & 1) div_zero[i + k] = 1;
+        }
+    }
+    div_scalar(a + i, b + i, n - i, div_zero + i);
+}
+
+const BatchKernels AVX2_KERNELS = {"avx2", neg_avx2, add_avx2, sub_avx2, mul_avx2, div_avx2};
+#endif
+
+// Picks the widest kernel set the CPU supports, once at startup
+const BatchKernels& select_batch_kernels() {
+#ifdef TASK4_X86
+    if (__builtin_cpu_supports("avx2")) return AVX2_KERNELS;
+#endif
+    return SCALAR_KERNELS;
+}
+
+const BatchKernels& batch_kernels = select_batch_kernels();
+
+// Rows evaluated together; one stack entry per block stays in L1
+const size_t BATCH_BLOCK = 256;
+
+// Evaluates the bytecode over `rows` rows. columns[slot] holds the values of
+// variable `slot` for every row. One instruction at a time is applied to a
+// block of rows, so dispatch is paid per block, not per row. A row that
+// divides by zero gets NaN in `out` and, when `div_zero` is given, a 1 there
+// (other rows get 0). Results match run() row for row.
+// Programs with conditionals take different paths per row, so they are run
+// row by row with run() instead.
+void Bytecode::run_batch(const double* const* columns, size_t rows, double* out,
+                         uint8_t* div_zero, const BatchKernels* kernels) const {
+    const BatchKernels& k = kernels ? *kernels : batch_kernels;
+    bool branches = any_of(code.begin(), code.end(), [](const Instruction& in) {
+        return in.op == OpCode::JUMP || in.op == OpCode::JUMP_IF_FALSE;
+    });
+    if (branches) {
+        vector<double> values(names.size());
+        for (size_t r = 0; r < rows; ++r) {
+            for (size_t slot = 0; slot < values.size(); ++slot) values[slot] = columns[slot][r];
+            bool failed = false;
+            out[r] = run(values.data(), &failed);
+            if (div_zero) div_zero[r] = failed;
+        }
+        return;
+    }
+
+    vector<double> stack(max(max_stack, 1u) * BATCH_BLOCK);
+    uint8_t scratch[BATCH_BLOCK];
+    for (size_t base = 0; base < rows; base += BATCH_BLOCK) {
+        size_t n = min(BATCH_BLOCK, rows - base);
+        uint8_t* flags = div_zero ? div_zero + base : scratch;
+        memset(flags, 0, n);
+        double* top = stack.data() - BATCH_BLOCK;  // current top entry
+        for (const Instruction& in : code) {
+            switch (in.op) {
+            case OpCode::PUSH_CONST:
+                top += BATCH_BLOCK;
+                fill(top, top + n, constants[in.arg]);
+                break;
+            case OpCode::LOAD_VAR:
+                top += BATCH_BLOCK;
+                memcpy(top, columns[in.arg] + base, n * sizeof(double));
+                break;
+            case OpCode::NEG: k.neg(top, n); break;
+            case OpCode::ADD: top -= BATCH_BLOCK; k.add(top, top + BATCH_BLOCK, n); break;
+            case OpCode::SUB: top -= BATCH_BLOCK; k.sub(top, top + BATCH_BLOCK, n); break;
+            case OpCode::MUL: top -= BATCH_BLOCK; k.mul(top, top + BATCH_BLOCK, n); break;
+            case OpCode::DIV: top -= BATCH_BLOCK; k.div(top, top + BATCH_BLOCK, n, flags); break;
+            case OpCode::RET: memcpy(out + base, top, n * sizeof(double)); break;
+            default: {
+                NodeType type = OPCODE_NODE_TYPES[(size_t)in.op];
+                if (is_unary(type)) {
+                    for (size_t i = 0; i < n; ++i) top[i] = apply_unary(type, top[i]);
+                } else {
+                    top -= BATCH_BLOCK;
+                    for (size_t i = 0; i < n; ++i) top[i] = apply_binary(type, top[i], top[i + BATCH_BLOCK]);
+                }
+                break;
+            }
             }
         }
+    }
+}
 
-        return result;
+// Serialized layout, little-endian: "TK4B", u32 version, then u32 counts of
+// instructions, constants and variables; each instruction is u8 opcode and
+// u32 operand, each constant an IEEE-754 double, each name a u32 length
+// followed by its bytes.
+const char BYTECODE_MAGIC[4] = {'T', 'K', '4', 'B'};
+const uint32_t BYTECODE_VERSION = 2;  // 2 added POW .. JUMP; version 1 files still load
+
+void put_u32(ostream& out, uint32_t v) {
+    char b[4] = {(char)v, (char)(v >> 8), (char)(v >> 16), (char)(v >> 24)};
+    out.write(b, 4);
+}
+
+uint32_t get_u32(istream& in) {
+    unsigned char b[4];
+    if (!in.read(reinterpret_cast<char*>(b), 4)) throw runtime_error("Bytecode: truncated file");
+    return b[0] | b[1] << 8 | b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+void Bytecode::save(ostream& out) const {
+    out.write(BYTECODE_MAGIC, 4);
+    put_u32(out, BYTECODE_VERSION);
+    put_u32(out, (uint32_t)code.size());
+    put_u32(out, (uint32_t)constants.size());
+    put_u32(out, (uint32_t)names.size());
+    for (const Instruction& in : code) {
+        out.put((char)in.op);
+        put_u32(out, in.arg);
+    }
+    for (double c : constants) {
+        uint64_t bits;
+        memcpy(&bits, &c, sizeof bits);
+        put_u32(out, (uint32_t)bits);
+        put_u32(out, (uint32_t)(bits >> 32));
+    }
+    for (const string& name : names) {
+        put_u32(out, (uint32_t)name.size());
+        out.write(name.data(), name.size());
     }
+}
 
-    // Begins the parsing process and returns the final result
-    double parse() {
-        double result = expr();
-        if (currentToken.type != TokenType::END)
-            throw runtime_error("Syntax error: Unexpected input after expression");
+Bytecode Bytecode::load(istream& in) {
+    char magic[4];
+    if (!in.read(magic, 4) || memcmp(magic, BYTECODE_MAGIC, 4) != 0)
+        throw runtime_error("Bytecode: not a compiled expression");
+    uint32_t version = get_u32(in);
+    if (version < 1 || version > BYTECODE_VERSION) throw runtime_error("Bytecode: unsupported version");
+    Bytecode bc;
+    uint32_t n_code = get_u32(in), n_const = get_u32(in), n_names = get_u32(in);
+    const uint32_t LIMIT = 1u << 26;  // guards the allocations below against corrupt counts
+    if (n_code > LIMIT || n_const > LIMIT || n_names > LIMIT) throw runtime_error("Bytecode: bad counts");
+    bc.code.resize(n_code);
+    for (Instruction& ins : bc.code) {
+        int op = in.get();
+        if (op == EOF) throw runtime_error("Bytecode: truncated file");
+        ins.op = (OpCode)op;
+        ins.arg = get_u32(in);
+    }
+    bc.constants.resize(n_const);
+    for (double& c : bc.constants) {
+        uint64_t bits = get_u32(in);
+        bits |= (uint64_t)get_u32(in) << 32;
+        memcpy(&c, &bits, sizeof c);
+    }
+    bc.names.resize(n_names);
+    for (string& name : bc.names) {
+        uint32_t len = get_u32(in);
+        if (len > LIMIT) throw runtime_error("Bytecode: bad name length");
+        name.resize(len);
+        if (!in.read(&name[0], len)) throw runtime_error("Bytecode: truncated file");
+    }
+    bc.validate();
+    return bc;
+}
+
+#ifdef TASK4_JIT
+// Native x86-64 code for one bytecode program, built without any JIT
+// library. The evaluation stack lives in registers: stack entry d is xmm<d>,
+// xmm14 holds 0.0 and xmm15 the sign mask, so programs needing more than 14
+// entries are not compiled. The generated function follows the SysV ABI:
+//     double fn(const double* values, const double* constants, int* failed)
+// and sets *failed on division by zero, which run() turns into the same
+// exception the VM throws. The page is written first and only then made
+// executable, never both at once.
+class JitCode {
+    using Fn = double (*)(const double*, const double*, int*);
+    static const int MAX_STACK = 14;
+
+    void* page = nullptr;
+    size_t length = 0;
+    Fn fn = nullptr;
+    vector<double> constants;  // the bytecode's pool, then -0.0 as sign mask
+    vector<uint8_t> bytes;
+
+    void rex_for(int reg, int rm) {
+        if (reg >= 8 || rm >= 8) bytes.push_back(0x40 | (reg >= 8) << 2 | (rm >= 8));
+    }
+
+    // prefix [REX] 0F opcode with register-register ModRM
+    void sse(uint8_t prefix, uint8_t opcode, int reg, int rm) {
+        bytes.push_back(prefix);
+        rex_for(reg, rm);
+        bytes.insert(bytes.end(), {0x0F, opcode, (uint8_t)(0xC0 | (reg & 7) << 3 | (rm & 7))});
+    }
+
+    // movsd xmm<reg>, [base + disp32]; base is rdi (7) or rsi (6)
+    void load(int reg, int base, uint32_t index) {
+        uint32_t disp = index * 8;
+        bytes.push_back(0xF2);
+        rex_for(reg, 0);
+        bytes.insert(bytes.end(), {0x0F, 0x10, (uint8_t)(0x80 | (reg & 7) << 3 | base)});
+        for (int i = 0; i < 4; ++i) bytes.push_back((uint8_t)(disp >> (8 * i)));
+    }
+
+    JitCode() = default;
+
+public:
+    ~JitCode() {
+        if (page) munmap(page, length);
+    }
+
+    JitCode(const JitCode&) = delete;
+    JitCode& operator=(const JitCode&) = delete;
+
+    // Returns nullptr when the program cannot be compiled or the page cannot
+    // be mapped; the caller then keeps using the VM
+    static unique_ptr<JitCode> compile(const Bytecode& code) {
+        if (code.stack_size() > MAX_STACK) return nullptr;
+        const uint32_t RDI = 7, RSI = 6;
+        unique_ptr<JitCode> jit(new JitCode());
+        jit->constants = code.constant_pool();
+        jit->constants.push_back(-0.0);
+        uint32_t sign_index = (uint32_t)jit->constants.size() - 1;
+
+        jit->sse(0x66, 0x57, 14, 14);             // xorpd xmm14, xmm14
+        jit->load(15, RSI, sign_index);           // movsd xmm15, [sign mask]
+        int depth = 0;
+        for (const Instruction& in : code.instructions()) {
+            switch (in.op) {
+            case OpCode::PUSH_CONST: jit->load(depth++, RSI, in.arg); break;
+            case OpCode::LOAD_VAR: jit->load(depth++, RDI, in.arg); break;
+            case OpCode::NEG: jit->sse(0x66, 0x57, depth - 1, 15); break;  // xorpd
+            case OpCode::ADD: --depth; jit->sse(0xF2, 0x58, depth - 1, depth); break;
+            case OpCode::SUB: --depth; jit->sse(0xF2, 0x5C, depth - 1, depth); break;
+            case OpCode::MUL: --depth; jit->sse(0xF2, 0x59, depth - 1, depth); break;
+            case OpCode::DIV:
+                --depth;
+                jit->sse(0x66, 0x2E, depth, 14);  // ucomisd denominator, 0.0
+                // jp/jne over "mov dword [rdx], 1; ret": NaN and non-zero divide
+                jit->bytes.insert(jit->bytes.end(), {0x7A, 0x09, 0x75, 0x07,
+                                                     0xC7, 0x02, 0x01, 0x00, 0x00, 0x00, 0xC3});
+                jit->sse(0xF2, 0x5E, depth - 1, depth);
+                break;
+            case OpCode::RET: jit->bytes.push_back(0xC3); break;  // result is in xmm0
+            default: return nullptr;  // functions, comparisons and branches stay on the VM
+            }
+        }
+
+        jit->length = jit->bytes.size();
+        void* page = mmap(nullptr, jit->length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (page == MAP_FAILED) return nullptr;
+        memcpy(page, jit->bytes.data(), jit->length);
+        if (mprotect(page, jit->length, PROT_READ | PROT_EXEC) != 0) {
+            munmap(page, jit->length);
+            return nullptr;
+        }
+        jit->page = page;
+        jit->fn = reinterpret_cast<Fn>(page);
+        jit->bytes = vector<uint8_t>();
+        return jit;
+    }
+
+    size_t code_size() const { return length; }
+
+    double run(const double* values) const {
+        int failed = 0;
+        double result = fn(values, constants.data(), &failed);
+        if (failed) throw runtime_error("Math error: Division by zero");
         return result;
     }
 };
+#else
+// Stand-in where native code generation is unavailable: nothing compiles
+class JitCode {
+public:
+    static unique_ptr<JitCode> compile(const Bytecode&) { return nullptr; }
+    size_t code_size() const { return 0; }
+    double run(const double*) const { return 0; }
+};
+#endif
+
+// Evaluations after which an expression is compiled to native code; an
+// expression evaluated fewer times never pays for the JIT
+const uint64_t JIT_THRESHOLD = 1000;
+const uint64_t JIT_NEVER = UINT64_MAX;
+
+// Promotion state of one expression, shared by every thread evaluating it.
+// The counter is bumped with a plain load and store rather than an atomic
+// increment, so concurrent evaluations may lose counts but never contend on
+// a locked instruction; promotion happens under `m`, once.
+struct JitState {
+    atomic<uint64_t> evaluations{0};
+    atomic<uint64_t> threshold{JIT_THRESHOLD};
+    atomic<const JitCode*> native{nullptr};
+    atomic<bool> attempted{false};
+    mutex m;
+    unique_ptr<JitCode> code;
+};
+
+// A compiled expression: parse once, then bind variables and evaluate as
+// often as needed. Variables are numbered in order of first appearance and
+// start out as NaN until bound.
+class Expression {
+    Bytecode code;
+    vector<double> bound;
+    unique_ptr<JitState> jit = make_unique<JitState>();
+
+    // Counts one evaluation and compiles to native code at the threshold
+    const JitCode* native_code() const {
+        const JitCode* native = jit->native.load(memory_order_acquire);
+        if (native || jit->attempted.load(memory_order_relaxed)) return native;
+        uint64_t n = jit->evaluations.load(memory_order_relaxed) + 1;
+        jit->evaluations.store(n, memory_order_relaxed);
+        if (n < jit->threshold.load(memory_order_relaxed)) return nullptr;
+        lock_guard<mutex> lock(jit->m);
+        if (!jit->attempted) {
+            jit->code = JitCode::compile(code);
+            jit->native.store(jit->code.get(), memory_order_release);
+            jit->attempted = true;
+        }
+        return jit->code.get();
+    }
+
+public:
+    // With `optimized`, the tree goes through optimize() before lowering
+    explicit Expression(const string& text, bool optimized = true) {
+        Arena arena;
+        SymbolTable symbols;
+        Parser parser(text);
+        const Node* root = parser.compile(arena, symbols);
+        if (optimized) root = optimize(root, arena);
+        code = Bytecode(root, symbols);
+        bound.assign(symbols.size(), numeric_limits<double>::quiet_NaN());
+    }
+
+    explicit Expression(Bytecode compiled) : code(move(compiled)) {
+        bound.assign(code.variables().size(), numeric_limits<double>::quiet_NaN());
+    }
+
+    const vector<string>& variables() const { return code.variables(); }
+    const Bytecode& bytecode() const { return code; }
+
+    // Slot of a variable, for binding by index on hot paths
+    uint32_t slot(const string& name) const {
+        const vector<string>& names = code.variables();
+        for (uint32_t s = 0; s < names.size(); ++s)
+            if (names[s] == name) return s;
+        throw invalid_argument("Unknown variable: " + name);
+    }
+
+    void bind(uint32_t slot, double value) { bound[slot] = value; }
+    void bind(const string& name, double value) { bound[slot(name)] = value; }
+
+    // Binds every slot at once; `values` must hold variables().size() entries
+    void bind(const vector<double>& values) {
+        if (values.size() != bound.size()) throw invalid_argument("Wrong number of bound values");
+        bound = values;
+    }
+
+    double evaluate() const { return evaluate(bound.data()); }
+
+    // Evaluates with caller-owned values, one per slot. The first evaluations
+    // run on the VM; after the JIT threshold, native code runs instead.
+    double evaluate(const double* values) const {
+        if (const JitCode* native = native_code()) return native->run(values);
+        return code.run(values);
+    }
+
+    // Evaluations before native compilation: 0 compiles on the next call,
+    // JIT_NEVER keeps the VM. Must be set before the expression is shared.
+    void set_jit_threshold(uint64_t evaluations) { jit->threshold = evaluations; }
+
+    // True once native code is in use (false on platforms without the JIT)
+    bool is_native() const { return jit->native.load() != nullptr; }
+
+    // Evaluates every row of a columnar input; see Bytecode::run_batch
+    void evaluate_batch(const vector<const double*>& columns, size_t rows, double* out,
+                        uint8_t* div_zero = nullptr) const {
+        if (columns.size() != bound.size()) throw invalid_argument("Wrong number of columns");
+        code.run_batch(columns.data(), rows, out, div_zero);
+    }
+};
+
+// Canonical form of a source text for cache keys: whitespace is dropped,
+// except one space between two word characters, where it separates tokens
+// ("1 2" must not become "12")
+void normalize_source(string_view text, string& out) {
+    out.clear();
+    bool pending_space = false;
+    for (char c : text) {
+        uint8_t cls = char_class(c);
+        if (cls & CC_SPACE) {
+            pending_space = !out.empty();
+            continue;
+        }
+        if (pending_space) {
+            // "a b" and "< =" mean something else without the space
+            bool word = (char_class(out.back()) & (CC_NUMBER | CC_IDENT)) && (cls & (CC_NUMBER | CC_IDENT));
+            bool comparison = c == '=' && string_view("<>=!").find(out.back()) != string_view::npos;
+            if (word || comparison) out += ' ';
+            pending_space = false;
+        }
+        out += c;
+    }
+}
+
+// 64-bit FNV-1a
+uint64_t hash_source(string_view text) {
+    uint64_t h = 1469598103934665603ull;
+    for (char c : text) {
+        h ^= (uint8_t)c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// Bounded, thread-safe LRU cache of compiled expressions, keyed by the hash
+// of the normalized source. The key space is split across independently
+// locked shards (chosen by the hash), each with its own LRU list and a share
+// of the capacity, so lookups on different shards never contend. A miss
+// compiles outside the lock; if two threads race on the same text, the
+// first insert wins and the other compile is dropped. Entries keep the full
+// normalized text, so a hash collision is a miss, not a wrong answer.
+// Cached expressions are shared: evaluate them with caller-owned values.
+class ExpressionCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        size_t size = 0;
+    };
+
+private:
+    struct Entry {
+        uint64_t hash;
+        string source;
+        shared_ptr<const Expression> expression;
+    };
+
+    struct Shard {
+        mutable mutex m;
+        list<Entry> lru;  // most recently used first
+        unordered_multimap<uint64_t, list<Entry>::iterator> index;
+        size_t capacity = 0;
+        Stats stats;
+    };
+
+    vector<unique_ptr<Shard>> shards;
+
+    // Entry for `source` in `shard`, or lru.end(); the caller holds the lock
+    static list<Entry>::iterator find(Shard& shard, uint64_t hash, const string& source) {
+        auto range = shard.index.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it)
+            if (it->second->source == source) return it->second;
+        return shard.lru.end();
+    }
+
+public:
+    // `capacity` entries in total, spread over `shard_count` shards (rounded
+    // up to a power of two)
+    explicit ExpressionCache(size_t capacity, size_t shard_count = 16) {
+        size_t n = 1;
+        while (n < shard_count) n <<= 1;
+        for (size_t i = 0; i < n; ++i) {
+            shards.push_back(make_unique<Shard>());
+            shards.back()->capacity = max<size_t>(1, (capacity + n - 1) / n);
+        }
+    }
+
+    // Returns the compiled form of `text`, compiling it on a miss; parse
+    // errors propagate and are not cached
+    shared_ptr<const Expression> get(string_view text) {
+        thread_local string source;
+        normalize_source(text, source);
+        uint64_t hash = hash_source(source);
+        Shard& shard = *shards[(hash >> 32) & (shards.size() - 1)];
+        {
+            lock_guard<mutex> lock(shard.m);
+            auto it = find(shard, hash, source);
+            if (it != shard.lru.end()) {
+                shard.lru.splice(shard.lru.begin(), shard.lru, it);
+                shard.stats.hits++;
+                return it->expression;
+            }
+            shard.stats.misses++;
+        }
+
+        auto compiled = make_shared<const Expression>(source);
+        lock_guard<mutex> lock(shard.m);
+        auto it = find(shard, hash, source);
+        if (it != shard.lru.end()) return it->expression;
+        shard.lru.push_front(Entry{hash, source, compiled});
+        shard.index.emplace(hash, shard.lru.begin());
+        if (shard.lru.size() > shard.capacity) {
+            Entry& victim = shard.lru.back();
+            auto range = shard.index.equal_range(victim.hash);
+            for (auto v = range.first; v != range.second; ++v) {
+                if (&*v->second == &victim) {
+                    shard.index.erase(v);
+                    break;
+                }
+            }
+            shard.lru.pop_back();
+            shard.stats.evictions++;
+        }
+        return compiled;
+    }
+
+    // Counters summed over all shards
+    Stats stats() const {
+        Stats total;
+        for (const auto& shard : shards) {
+            lock_guard<mutex> lock(shard->m);
+            total.hits += shard->stats.hits;
+            total.misses += shard->stats.misses;
+            total.evictions += shard->stats.evictions;
+            total.size += shard->lru.size();
+        }
+        return total;
+    }
+};
+
+// Random formula over the variables a, b and c for self-checks; constants
+// favour the values the optimizer rewrites around
+string random_formula(mt19937_64& rng, int depth, bool extended = false) {
+    static const char* const LEAVES[] = {"a", "b", "c", "0", "1", "2", "0.5", "3", "60", "0.1", "1024"};
+    static const char* const OPS[] = {"+", "-", "*", "/", "^", "<", "<=", ">", ">=", "==", "!="};
+    static const char* const FUNCTIONS[] = {"abs", "sqrt", "log", "exp", "min", "max"};
+    uint64_t pick = rng() % (extended ? 13 : 10);
+    if (depth == 0 || pick < 3) return LEAVES[rng() % size(LEAVES)];
+    if (pick == 3) return "-" + random_formula(rng, depth - 1, extended);
+    if (pick == 10) {
+        const char* name = FUNCTIONS[rng() % size(FUNCTIONS)];
+        string text = string(name) + '(' + random_formula(rng, depth - 1, extended);
+        if (name[0] == 'm')
+            for (uint64_t args = 1 + rng() % 2; args-- > 0;) text += ", " + random_formula(rng, depth - 1, extended);
+        return text + ')';
+    }
+    if (pick == 11)
+        return "(" + random_formula(rng, depth - 1, extended) + " ? " + random_formula(rng, depth - 1, extended) +
+               " : " + random_formula(rng, depth - 1, extended) + ")";
+    const char* op = OPS[rng() % (extended ? size(OPS) : 4)];
+    string text = random_formula(rng, depth - 1, extended) + ' ' + op + ' ' + random_formula(rng, depth - 1, extended);
+    return pick < 7 ? "(" + text + ")" : text;
+}
+
+// Formulas for the benchmark, from a bare constant to a long chain
+const char* const BENCH_FORMULAS[] = {
+    "42",
+    "1.5 * (2 + 3.25) - 4 / 8",
+    "((1 + 2) * (3 + 4) - (5 - 6) * (7 + 8)) / ((9 - 10) * 11 + 12.5)",
+    "-(1 + 2 * 3 - 4 / 5) * (6 - 7 * (8 + 9 / (10 - 11))) + 12 * 13 - 14 / 15 + 16 * -17",
+};
+
+// Benchmark results are stored here so the timed loops are not optimized out
+volatile double bench_sink;
+
+// Time per evaluation of each formula: re-parsed on every call, the AST
+// walked recursively, the bytecode run on the VM and as native code
+void benchmark(size_t iterations) {
+    cout << "formula_length,parse_each_ns,tree_ns,vm_ns,jit_ns,parse_vs_vm\n";
+    for (const char* text : BENCH_FORMULAS) {
+        auto t0 = chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; ++i) bench_sink = Parser(text).parse();
+        auto t1 = chrono::steady_clock::now();
+        Arena arena;
+        SymbolTable symbols;
+        const Node* root = Parser(text).compile(arena, symbols);
+        for (size_t i = 0; i < iterations; ++i) bench_sink = evaluate(root, nullptr);
+        auto t2 = chrono::steady_clock::now();
+        Expression compiled(text, false);  // unoptimized: these formulas would fold away
+        compiled.set_jit_threshold(JIT_NEVER);
+        for (size_t i = 0; i < iterations; ++i) bench_sink = compiled.evaluate();
+        auto t3 = chrono::steady_clock::now();
+        Expression native(text, false);
+        native.set_jit_threshold(0);
+        for (size_t i = 0; i < iterations; ++i) bench_sink = native.evaluate();
+        auto t4 = chrono::steady_clock::now();
+
+        double parse_ns = chrono::duration<double, nano>(t1 - t0).count() / iterations;
+        double tree_ns = chrono::duration<double, nano>(t2 - t1).count() / iterations;
+        double vm_ns = chrono::duration<double, nano>(t3 - t2).count() / iterations;
+        double jit_ns = chrono::duration<double, nano>(t4 - t3).count() / iterations;
+        cout << string(text).size() << ',' << parse_ns << ',' << tree_ns << ',' << vm_ns << ','
+             << (native.is_native() ? jit_ns : NAN) << ',' << parse_ns / vm_ns << '\n';
+    }
+
+    // One formula over a million rows of columnar input: the VM called per
+    // row vs block evaluation with the scalar and the dispatched kernels
+    const size_t rows = 1 << 20;
+    Expression pricing("price * (1 + tax) - discount / qty");
+    vector<vector<double>> data(pricing.variables().size(), vector<double>(rows));
+    mt19937_64 rng(42);
+    uniform_real_distribution<double> dist(1.0, 100.0);
+    for (auto& column : data)
+        for (double& v : column) v = dist(rng);
+    vector<const double*> columns;
+    for (auto& column : data) columns.push_back(column.data());
+    vector<double> out(rows);
+
+    auto t0 = chrono::steady_clock::now();
+    vector<double> values(columns.size());
+    for (size_t r = 0; r < rows; ++r) {
+        for (size_t c = 0; c < columns.size(); ++c) values[c] = columns[c][r];
+        out[r] = pricing.evaluate(values.data());
+    }
+    auto t1 = chrono::steady_clock::now();
+    pricing.bytecode().run_batch(columns.data(), rows, out.data(), nullptr, &SCALAR_KERNELS);
+    auto t2 = chrono::steady_clock::now();
+    pricing.bytecode().run_batch(columns.data(), rows, out.data(), nullptr);
+    auto t3 = chrono::steady_clock::now();
+    bench_sink = out[rows / 2];
+
+    cout << "\nbatch_rows,per_row_ns,batch_scalar_ns,batch_" << batch_kernels.name << "_ns\n"
+         << rows << ',' << chrono::duration<double, nano>(t1 - t0).count() / rows << ','
+         << chrono::duration<double, nano>(t2 - t1).count() / rows << ','
+         << chrono::duration<double, nano>(t3 - t2).count() / rows << '\n';
+
+    // Lexer alone over about 32 MB of generated formulas, one per line
+    string text;
+    while (text.size() < (32u << 20)) {
+        text += random_formula(rng, 6);
+        text += '\n';
+    }
+    size_t tokens = 0;
+    vector<double> lex_times;
+    for (int run = 0; run < 3; ++run) {
+        auto start = chrono::steady_clock::now();
+        Lexer lexer(text);
+        tokens = 0;
+        while (lexer.getNextToken().type != TokenType::END) tokens++;
+        lex_times.push_back(chrono::duration<double>(chrono::steady_clock::now() - start).count());
+    }
+    double lex_sec = *min_element(lex_times.begin(), lex_times.end());
+    cout << "\nlex_bytes,tokens,lex_mb_per_s,mtokens_per_s\n"
+         << text.size() << ',' << tokens << ',' << text.size() / 1e6 / lex_sec << ','
+         << tokens / 1e6 / lex_sec << '\n';
+
+    // Cache lookups from 1..N threads over a working set of 2000 formulas that
+    // fits the cache; every thread looks up the same texts in its own order
+    vector<string> working_set;
+    for (int i = 0; i < 2000; ++i) working_set.push_back(random_formula(rng, 4));
+    cout << "\ncache_threads,lookups,mlookups_per_s,hits,misses,evictions\n";
+    size_t max_threads = max(1u, thread::hardware_concurrency());
+    for (size_t threads = 1;; threads = min(threads * 2, max_threads)) {
+        ExpressionCache cache(4096);
+        const size_t per_thread = 200000;
+        auto start = chrono::steady_clock::now();
+        vector<thread> workers;
+        for (size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                for (size_t i = 0; i < per_thread; ++i)
+                    cache.get(working_set[(i * 7919 + t * 104729) % working_set.size()]);
+            });
+        }
+        for (thread& w : workers) w.join();
+        double sec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        ExpressionCache::Stats st = cache.stats();
+        cout << threads << ',' << threads * per_thread << ',' << threads * per_thread / 1e6 / sec << ','
+             << st.hits << ',' << st.misses << ',' << st.evictions << '\n';
+        if (threads == max_threads) break;
+    }
+
+    // Generated inputs no one types: 100000 nested parentheses or minus
+    // signs and a 100000-term sum, which need no nesting levels, a power
+    // chain right at the depth limit, a balanced tree of 2^18 leaves and a
+    // power chain past the limit, which must be refused cleanly. Times are
+    // the best of 3 runs.
+    auto chain = [](const char* op, size_t terms) {
+        string text = "1";
+        for (size_t i = 1; i < terms; ++i) (text += op) += '1';
+        return text;
+    };
+    const size_t deep = 100000, limit = parse_limits.max_depth;
+    string balanced = "a";
+    for (int level = 0; level < 18; ++level) balanced = '(' + balanced + (level % 2 ? '*' : '+') + balanced + ')';
+    const pair<const char*, string> shapes[] = {
+        {"parens", string(deep, '(') + '1' + string(deep, ')')},
+        {"minus", string(deep, '-') + '1'},
+        {"sum", chain("+", deep)},
+        {"power", chain("^", limit - 1)},
+        {"balanced", balanced},
+        {"too_deep", chain("^", limit * 2)},
+    };
+    cout << "\nshape,bytes,parse_ms,compile_ms,mb_per_s,result\n";
+    for (const auto& [name, text] : shapes) {
+        double parse_ms = 1e300, compile_ms = 1e300;
+        string result;
+        for (int run = 0; run < 3; ++run) {
+            auto start = chrono::steady_clock::now();
+            try {
+                Arena arena;
+                SymbolTable symbols;
+                Parser(text).compile(arena, symbols);
+                result = "ok";
+            } catch (const runtime_error& ex) {
+                result = ex.what();
+            }
+            auto parsed = chrono::steady_clock::now();
+            try {
+                Expression expression(text);
+                double value = expression.evaluate(vector<double>(expression.variables().size(), 1.0).data());
+                char buf[32];
+                result.assign(buf, to_chars(buf, buf + sizeof buf, value).ptr);
+                bench_sink = value;
+            } catch (const runtime_error&) {
+            }
+            auto compiled = chrono::steady_clock::now();
+            parse_ms = min(parse_ms, chrono::duration<double, milli>(parsed - start).count());
+            compile_ms = min(compile_ms, chrono::duration<double, milli>(compiled - parsed).count());
+        }
+        cout << name << ',' << text.size() << ',' << parse_ms << ',' << compile_ms << ','
+             << text.size() / 1e3 / parse_ms << ",\"" << result << "\"\n";
+    }
+}
+
+// Read-only view of a whole input file: memory-mapped on POSIX systems,
+// read into memory elsewhere
+class InputFile {
+    string contents;  // fallback copy when the file is not mapped
+    const char* base = nullptr;
+    size_t length = 0;
+#ifdef TASK4_POSIX
+    bool mapped = false;
+#endif
+
+public:
+    explicit InputFile(const string& path) {
+#ifdef TASK4_POSIX
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw runtime_error("Cannot open " + path);
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                base = (const char*)p;
+                length = st.st_size;
+                mapped = true;
+                madvise(p, length, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd);
+        if (mapped) return;
+#endif
+        ifstream in(path, ios::binary);
+        if (!in) throw runtime_error("Cannot open " + path);
+        contents.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        base = contents.data();
+        length = contents.size();
+    }
+
+    ~InputFile() {
+#ifdef TASK4_POSIX
+        if (mapped) munmap((void*)base, length);
+#endif
+    }
+
+    InputFile(const InputFile&) = delete;
+    InputFile& operator=(const InputFile&) = delete;
+
+    string_view view() const { return string_view(base, length); }
+};
+
+// Input bytes per work item of evaluate_file(); batches end at a newline
+const size_t EVAL_BATCH_SIZE = 256 << 10;
+
+// Evaluates one expression per line of `text` and appends one output line
+// each: the shortest round-trip form of the result, "Error: ..." for a line
+// that fails, or nothing for a blank line. With a cache, repeated lines are
+// compiled once. Returns the number of errors.
+size_t evaluate_lines(string_view text, string& out, ExpressionCache* cache) {
+    size_t errors = 0;
+    while (!text.empty()) {
+        size_t end = text.find('\n');
+        string_view raw = text.substr(0, end);
+        text = end == string_view::npos ? string_view() : text.substr(end + 1);
+        if (!raw.empty() && raw.back() == '\r') raw.remove_suffix(1);
+        if (raw.find_first_not_of(" \t") == string_view::npos) {
+            out += '\n';
+            continue;
+        }
+        try {
+            double result;
+            if (cache) {
+                shared_ptr<const Expression> expression = cache->get(raw);
+                if (!expression->variables().empty())
+                    throw runtime_error("Unbound variable: " + expression->variables()[0]);
+                result = expression->evaluate(nullptr);
+            } else {
+                result = Parser(raw).parse();
+            }
+            char buf[32];
+            out.append(buf, to_chars(buf, buf + sizeof buf, result).ptr);
+        } catch (const exception& ex) {
+            out += "Error: ";
+            out += ex.what();
+            errors++;
+        }
+        out += '\n';
+    }
+    return errors;
+}
+
+// Evaluates every line of a file on `threads` workers and writes the results
+// to `out` in input order. The file is mapped and cut into batches at line
+// boundaries; workers claim batches in order, and at most 4 x threads
+// finished batches wait for the writer, so memory stays bounded. Returns the
+// number of lines that failed.
+size_t evaluate_file(const string& path, ostream& out, size_t threads, ExpressionCache* cache) {
+    InputFile input(path);
+    string_view text = input.view();
+    vector<string_view> batches;
+    while (!text.empty()) {
+        size_t end = text.size() <= EVAL_BATCH_SIZE ? string_view::npos : text.find('\n', EVAL_BATCH_SIZE);
+        end = end == string_view::npos ? text.size() : end + 1;
+        batches.push_back(text.substr(0, end));
+        text = text.substr(end);
+    }
+
+    const size_t window = 4 * max<size_t>(threads, 1);
+    vector<string> results(window);
+    vector<size_t> done(window, 0);  // batch number + 1 once results[] holds it
+    mutex m;
+    condition_variable batch_done, slot_free;
+    size_t written = 0;
+    atomic<size_t> next{0};
+    atomic<size_t> errors{0};
+    exception_ptr error;
+
+    auto worker = [&] {
+        string output;
+        for (size_t i; (i = next++) < batches.size();) {
+            {
+                unique_lock<mutex> lock(m);
+                slot_free.wait(lock, [&] { return error || i < written + window; });
+                if (error) return;
+            }
+            output.clear();
+            try {
+                errors += evaluate_lines(batches[i], output, cache);
+            } catch (...) {
+                lock_guard<mutex> lock(m);
+                if (!error) error = current_exception();
+                batch_done.notify_all();
+                return;
+            }
+            lock_guard<mutex> lock(m);
+            results[i % window].swap(output);
+            done[i % window] = i + 1;
+            batch_done.notify_all();
+        }
+    };
+    vector<thread> pool;
+    for (size_t t = 0; t < max<size_t>(threads, 1); ++t) pool.emplace_back(worker);
+
+    for (size_t i = 0; i < batches.size(); ++i) {
+        unique_lock<mutex> lock(m);
+        batch_done.wait(lock, [&] { return error || done[i % window] == i + 1; });
+        if (error) break;
+        string chunk;
+        chunk.swap(results[i % window]);
+        lock.unlock();
+        out.write(chunk.data(), chunk.size());
+        lock.lock();
+        written++;
+        slot_free.notify_all();
+    }
+    for (thread& t : pool) t.join();
+    if (error) rethrow_exception(error);
+    out.flush();
+    return errors;
+}
+
+// Self-check for optimize() and the JIT: random formulas, evaluated
+// unoptimized and optimized on the VM and in batch, and as native code where
+// available, over inputs that include -0, infinities and NaN. Results must
+// match bit for bit and division by zero must fail in the same rows.
+// Batch results only need to agree on NaN-ness: formulas with conditionals
+// run row by row there, and which NaN operand x86 propagates depends on
+// operand order, which IEEE leaves to the compiler. Returns the number of
+// mismatches.
+size_t self_check(size_t formulas) {
+    static const double INPUTS[] = {0.0, -0.0, 1.0, -1.0, 2.0, 0.5, 3.0, 1e-310, 1e308, -7.25,
+                                    numeric_limits<double>::infinity(),
+                                    -numeric_limits<double>::infinity(),
+                                    numeric_limits<double>::quiet_NaN()};
+    const size_t n = size(INPUTS);
+    mt19937_64 rng(2024);
+    size_t mismatches = 0, evaluations = 0;
+
+    // Every combination of inputs for a, b and c, as columns
+    vector<vector<double>> data(3);
+    for (size_t i = 0; i < n * n * n; ++i) {
+        data[0].push_back(INPUTS[i % n]);
+        data[1].push_back(INPUTS[i / n % n]);
+        data[2].push_back(INPUTS[i / n / n]);
+    }
+    size_t rows = data[0].size();
+
+    for (size_t f = 0; f < formulas; ++f) {
+        string text = random_formula(rng, 5, f % 2 == 1);
+        Expression plain(text, false), optimized(text, true), native(text, true);
+        plain.set_jit_threshold(JIT_NEVER);
+        optimized.set_jit_threshold(JIT_NEVER);
+        native.set_jit_threshold(0);
+        vector<const double*> columns;
+        for (const string& name : plain.variables()) columns.push_back(data[name[0] - 'a'].data());
+
+        vector<double> batch_plain(rows), batch_opt(rows);
+        vector<uint8_t> zero_plain(rows), zero_opt(rows);
+        plain.evaluate_batch(columns, rows, batch_plain.data(), zero_plain.data());
+        optimized.evaluate_batch(columns, rows, batch_opt.data(), zero_opt.data());
+
+        for (size_t r = 0; r < rows; ++r) {
+            vector<double> values;
+            for (const double* column : columns) values.push_back(column[r]);
+            double x = 0, y = 0, z = 0;
+            bool x_failed = false, y_failed = false, z_failed = false;
+            try { x = plain.evaluate(values.data()); } catch (const runtime_error&) { x_failed = true; }
+            try { y = optimized.evaluate(values.data()); } catch (const runtime_error&) { y_failed = true; }
+            try { z = native.evaluate(values.data()); } catch (const runtime_error&) { z_failed = true; }
+            evaluations++;
+            bool same = x_failed == y_failed && (x_failed || memcmp(&x, &y, sizeof x) == 0) &&
+                        x_failed == z_failed && (x_failed || memcmp(&x, &z, sizeof x) == 0) &&
+                        zero_plain[r] == zero_opt[r] &&
+                        (memcmp(&batch_plain[r], &batch_opt[r], sizeof x) == 0 ||
+                         (isnan(batch_plain[r]) && isnan(batch_opt[r])));
+            if (!same) {
+                if (mismatches++ < 10) cerr << "Mismatch: " << text << " at row " << r << '\n';
+            }
+        }
+    }
+    cout << formulas << " formulas, " << evaluations << " evaluations, " << mismatches
+         << " mismatches\n";
+    return mismatches;
+}
+
+// Asks for a value (itself a constant expression) for every variable, then
+// evaluates
+double prompt_and_evaluate(Expression& expression) {
+    const vector<string>& vars = expression.variables();
+    for (uint32_t slot = 0; slot < vars.size(); ++slot) {
+        cout << "Value of " << vars[slot] << ":\n";
+        string line;
+        getline(cin, line);
+        expression.bind(slot, Parser(line).parse());
+    }
+    return expression.evaluate();
+}
+
+// Entry point of the program. Without arguments it evaluates one expression
+// from stdin; "bench [N]" runs the benchmark, "check [N]" self-checks the
+// optimizer on N random formulas, "eval FILE [THREADS] [--cache N]
+// [--max-depth D]" evaluates every line of FILE in parallel (through an
+// N-entry cache, refusing trees nested deeper than D), "compile FILE" saves
+// the bytecode of the expression on stdin and "run FILE" evaluates saved
+// bytecode.
+int main(int argc, char* argv[]) {
+    string command = argc > 1 ? argv[1] : "";
+    try {
+        if (command == "bench") {
+            benchmark(argc > 2 ? strtoull(argv[2], nullptr, 10) : 1000000);
+            return 0;
+        }
+        if (command == "eval") {
+            if (argc < 3) throw invalid_argument("eval needs an input file");
+            size_t threads = thread::hardware_concurrency();
+            unique_ptr<ExpressionCache> cache;
+            for (int i = 3; i < argc; ++i) {
+                if (string(argv[i]) == "--cache" && i + 1 < argc)
+                    cache = make_unique<ExpressionCache>(strtoull(argv[++i], nullptr, 10));
+                else if (string(argv[i]) == "--max-depth" && i + 1 < argc)
+                    parse_limits.max_depth = strtoull(argv[++i], nullptr, 10);
+                else
+                    threads = strtoul(argv[i], nullptr, 10);
+            }
+            ios::sync_with_stdio(false);
+            size_t errors = evaluate_file(argv[2], cout, threads, cache.get());
+            if (cache) {
+                ExpressionCache::Stats st = cache->stats();
+                cerr << "Cache: " << st.hits << " hits, " << st.misses << " misses, " << st.evictions
+                     << " evictions, " << st.size << " entries\n";
+            }
+            return errors == 0 ? 0 : 1;
+        }
+        if (command == "check") {
+            return self_check(argc > 2 ? strtoull(argv[2], nullptr, 10) : 2000) == 0 ? 0 : 1;
+        }
+        if (command == "run") {
+            if (argc < 3) throw invalid_argument("run needs a bytecode file");
+            ifstream in(argv[2], ios::binary);
+            if (!in) throw runtime_error(string("Cannot open ") + argv[2]);
+            Expression expression(Bytecode::load(in));
+            double result = prompt_and_evaluate(expression);
+            cout << "Result: " << result << endl;
+            return 0;
+        }
+        if (!command.empty() && command != "compile")
+            throw invalid_argument("Unknown command: " + command);
+    } catch (const exception& ex) {
+        cerr << "Error: " << ex.what() << endl;
+        return 1;
+    }
 
-// Entry point of the program
-int main() {
     cout << "Enter an arithmetic expression:\n";
     string input;
     getline(cin, input);
 
     try {
-        Parser parser(input);
-        double result = parser.parse();
+        Expression expression(input);
+        if (command == "compile") {
+            if (argc < 3) throw invalid_argument("compile needs an output file");
+            ofstream out(argv[2], ios::binary);
+            expression.bytecode().save(out);
+            if (!out.flush()) throw runtime_error(string("Cannot write ") + argv[2]);
+            cout << "Compiled " << expression.bytecode().instructions().size() << " instructions to "
+                 << argv[2] << endl;
+            return 0;
+        }
+        double result = prompt_and_evaluate(expression);
         cout << "Result: " << result << endl;
     } catch (const exception& ex) {
         cerr << "Error: " << ex.what() << endl;